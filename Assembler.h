@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "Instructions.h"
+
+// Throws for an operation or register the CPU doesn't have, which fails the build when the
+// instruction is encoded in a constant expression
+constexpr uint32_t EncInstr(uint32_t operation, uint32_t registerA, uint32_t registerB, uint32_t immediate = 0x0)
+{
+    if(operation > GETTRAP) throw std::invalid_argument("Unknown operation");
+    if(registerA >= REGISTER_COUNT || registerB >= REGISTER_COUNT) throw std::invalid_argument("Unknown register");
+
+    uint32_t instruction =
+      (operation << 24)       // 8 bits -> operation
+    | (registerA << 20)       // 4 bits -> registerA
+    | (registerB << 16)       // 4 bits -> registerB
+    | (immediate & 0xFFFF);   // 16 bits -> immediate
+
+    return instruction;
+}
+
+// Lay instruction words out as little endian bytes from adress 0, padded with 0xFF up to size
+inline std::vector<uint8_t> ImageBytes(const std::vector<uint32_t>& words, size_t size)
+{
+    std::vector<uint8_t> image(size, 0xFF);
+
+    for(size_t i = 0; i < words.size() && i * 4 + 3 < size; i++)
+    {
+        image[i * 4] = words[i] & 0xFF;
+        image[i * 4 + 1] = (words[i] >> 8) & 0xFF;
+        image[i * 4 + 2] = (words[i] >> 16) & 0xFF;
+        image[i * 4 + 3] = (words[i] >> 24) & 0xFF;
+    }
+
+    return image;
+}
+
+// ASSEMBLER. Programs written as a list of lines and assembled in a constant expression:
+//
+//     constexpr auto COUNT = Assemble(0x0, {
+//         Op(MVI, 0, 0, 10),
+//         Op(SUBI, 0, 0, 1).label("loop"),
+//         Op(CMP, 0, 1),
+//         Op(JNZ, 0, 0, Target("loop")),
+//         Op(HLT)
+//     });
+//
+// Unknown operations or registers, immediates over 16 bits, unknown or twice defined labels and
+// jumps to unaligned adresses don't compile.
+
+struct AsmTarget
+{
+    const char* name;
+};
+
+// Label as the immediate of an instruction, replaced by the adress of the line it names
+constexpr AsmTarget Target(const char* name)
+{
+    return AsmTarget{ name };
+}
+
+struct AsmLine
+{
+    uint32_t word;                      // Raw data word when operation is ~0u
+    uint32_t operation;
+    uint32_t registerA;
+    uint32_t registerB;
+    uint32_t immediate;
+    const char* target;                 // Label used as the immediate, nullptr for a plain immediate
+    const char* name;                   // Label of this line, nullptr for none
+
+    // The same line with a label other lines can jump to
+    constexpr AsmLine label(const char* label_name) const
+    {
+        AsmLine line = *this;
+        line.name = label_name;
+        return line;
+    }
+};
+
+constexpr AsmLine Op(uint32_t operation, uint32_t registerA = 0, uint32_t registerB = 0, uint32_t immediate = 0)
+{
+    return AsmLine{ 0, operation, registerA, registerB, immediate, nullptr, nullptr };
+}
+
+constexpr AsmLine Op(uint32_t operation, uint32_t registerA, uint32_t registerB, AsmTarget target)
+{
+    return AsmLine{ 0, operation, registerA, registerB, 0, target.name, nullptr };
+}
+
+// A data word placed as it is
+constexpr AsmLine Word(uint32_t value)
+{
+    return AsmLine{ value, ~0u, 0, 0, 0, nullptr, nullptr };
+}
+
+constexpr bool SameLabel(const char* a, const char* b)
+{
+    while(*a && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Lines assembled into words for the adress origin, labels resolved to origin + 4 * their line
+template<size_t N>
+constexpr std::array<uint32_t, N> Assemble(uint32_t origin, const AsmLine (&lines)[N])
+{
+    std::array<uint32_t, N> words = {};
+
+    for(size_t i = 0; i < N; i++)
+    {
+        const AsmLine& line = lines[i];
+        if(line.name)
+            for(size_t j = 0; j < i; j++)
+                if(lines[j].name && SameLabel(lines[j].name, line.name))
+                    throw std::invalid_argument("Label defined twice");
+
+        if(line.operation == ~0u)
+        {
+            words[i] = line.word;
+            continue;
+        }
+
+        uint64_t immediate = line.immediate;
+        if(line.target)
+        {
+            size_t found = N;
+            for(size_t j = 0; j < N && found == N; j++)
+                if(lines[j].name && SameLabel(lines[j].name, line.target))
+                    found = j;
+
+            if(found == N) throw std::invalid_argument("Unknown label");
+            immediate = uint64_t(origin) + 4 * found;
+        }
+
+        if(immediate > 0xFFFF) throw std::invalid_argument("Immediate doesn't fit 16 bits");
+        if((line.operation == JMP || line.operation == JZ || line.operation == JNZ || line.operation == SETTRAP) && (immediate & 3))
+            throw std::invalid_argument("Jump to an unaligned adress");
+
+        words[i] = EncInstr(line.operation, line.registerA, line.registerB, uint32_t(immediate));
+    }
+
+    return words;
+}
+
+// words copied into image from adress on, for laying out ROM images in constant expressions
+template<size_t SIZE, size_t N>
+constexpr void Place(std::array<uint32_t, SIZE>& image, uint32_t adress, const std::array<uint32_t, N>& words)
+{
+    if(adress % 4 != 0 || adress / 4 + N > SIZE) throw std::invalid_argument("Words don't fit the image");
+
+    for(size_t i = 0; i < N; i++)
+        image[adress / 4 + i] = words[i];
+}
+
+// Image of SIZE words filled with 0xFF bytes, the padding ImageBytes() leaves
+template<size_t SIZE>
+constexpr std::array<uint32_t, SIZE> Padding()
+{
+    std::array<uint32_t, SIZE> image = {};
+    for(size_t i = 0; i < SIZE; i++)
+        image[i] = 0xFFFFFFFF;
+    return image;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "CPU.h"
+
+// Why a job stopped
+enum HaltReason
+{
+    HALT_INSTRUCTION,   // Ran into HLT
+    HALT_BUDGET,        // Used up its instruction budget
+    HALT_FAULT          // Trapped without a handler (illegal instruction, memory access out of range, write to ROM)
+};
+
+// Why a CPU came back from run(budget), from its state afterwards
+inline HaltReason GetHaltReason(const CPUState& state)
+{
+    if(!state.HALTED) return HALT_BUDGET;
+    return state.TRAPPED ? HALT_FAULT : HALT_INSTRUCTION;
+}
+
+// One run of the shared ROM from adress 0
+struct Job
+{
+    std::vector<uint8_t> ram;                   // Initial RAM contents, the rest of RAM is zero
+    uint32_t registers[REGISTER_COUNT];         // Initial registers
+    uint64_t budget;                            // Most instructions the job may run
+};
+
+struct JobResult
+{
+    CPUState state;                             // Final registers, PC and flags
+    HaltReason reason;
+    uint64_t executed;                          // Instructions run, the faulting one included
+    uint32_t fault;                             // Trap cause for HALT_FAULT (see FaultName()), FAULT_NONE otherwise
+};
+
+// Runs batches of jobs over one ROM on a pool of worker threads. Every worker owns an instance
+// (RAM, MEMC, CPU) made once and reused for all its jobs, so starting a job only loads its RAM
+// and registers. Jobs are dealt round robin into per worker queues; a worker takes from the back
+// of its own queue and, once that is empty, steals from the front of the others.
+template<typename TracePolicy = NoTrace>
+class BatchRunner
+{
+private:
+    struct Instance
+    {
+        RAM ram;
+        MEMC memory;
+        CPU<TracePolicy> cpu;
+
+        Instance(ROM* rom, size_t ram_size, Engine engine) : ram(ram_size), memory(rom, &ram), cpu(&memory, engine) {}
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<uint32_t> jobs;              // Job indices
+    };
+
+    std::vector<std::unique_ptr<Instance>> instances;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    // Current batch, guarded by lock
+    std::mutex lock;
+    std::condition_variable started;
+    std::condition_variable finished;
+    const std::vector<Job>* jobs = nullptr;
+    std::vector<JobResult>* results = nullptr;
+    uint64_t batch = 0;                         // Number of the batch workers should run
+    unsigned busy = 0;                          // Workers still on the current batch
+    bool stopping = false;
+
+    bool take(unsigned worker, uint32_t& job)
+    {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if(!own.jobs.empty())
+            {
+                job = own.jobs.back();
+                own.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for(size_t i = 1; i < queues.size(); i++)
+        {
+            Queue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if(!victim.jobs.empty())
+            {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void execute(Instance& instance, const Job& job, JobResult& result)
+    {
+        instance.memory.loadRAM(job.ram.data(), job.ram.size());
+
+        CPUState state = {};
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            state.registers[i] = job.registers[i];
+        instance.cpu.setState(state);
+
+        result.executed = instance.cpu.run(job.budget);
+        result.state = instance.cpu.getState();
+        result.reason = GetHaltReason(result.state);
+        result.fault = result.reason == HALT_FAULT ? result.state.trapCause : uint32_t(FAULT_NONE);
+    }
+
+    void work(unsigned worker)
+    {
+        uint64_t done = 0;                      // Last batch this worker finished
+
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                started.wait(guard, [&] { return stopping || batch != done; });
+                if(stopping) return;
+                done = batch;
+            }
+
+            uint32_t job;
+            while(take(worker, job))
+                execute(*instances[worker], (*jobs)[job], (*results)[job]);
+
+            std::lock_guard<std::mutex> guard(lock);
+            if(--busy == 0) finished.notify_one();
+        }
+    }
+
+public:
+    // worker_count 0 uses every host core
+    BatchRunner(ROM* rom, size_t ram_size = MEMORY_SIZE_BYTES, unsigned worker_count = 0, Engine engine = ENGINE_THREADED)
+    {
+        if(worker_count == 0) worker_count = std::thread::hardware_concurrency();
+        if(worker_count == 0) worker_count = 1;
+
+        for(unsigned i = 0; i < worker_count; i++)
+        {
+            instances.emplace_back(new Instance(rom, ram_size, engine));
+            queues.emplace_back(new Queue);
+        }
+
+        for(unsigned i = 0; i < worker_count; i++)
+            workers.emplace_back(&BatchRunner::work, this, i);
+    }
+
+    BatchRunner(const BatchRunner&) = delete;
+    BatchRunner& operator=(const BatchRunner&) = delete;
+
+    ~BatchRunner()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        started.notify_all();
+
+        for(std::thread& worker : workers)
+            worker.join();
+    }
+
+    unsigned workerCount() const
+    {
+        return workers.size();
+    }
+
+    // Run every job and return their results in the same order
+    std::vector<JobResult> run(const std::vector<Job>& batch_jobs)
+    {
+        std::vector<JobResult> batch_results(batch_jobs.size());
+
+        for(size_t i = 0; i < batch_jobs.size(); i++)
+            queues[i % queues.size()]->jobs.push_back(i);   // Workers are all waiting, nobody else touches the queues
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            jobs = &batch_jobs;
+            results = &batch_results;
+            busy = workers.size();
+            batch++;
+            started.notify_all();
+
+            finished.wait(guard, [&] { return busy == 0; });
+            jobs = nullptr;
+            results = nullptr;
+        }
+
+        return batch_results;
+    }
+};
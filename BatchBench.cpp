@@ -0,0 +1,117 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Batch.h"
+#include "Storage.h"
+
+const int DEFAULT_JOBS = 100000;
+const int REPETITIONS = 10;             // Batches per worker count
+
+// Same job on a fresh instance, what the batch runner has to agree with
+JobResult Reference(ROM* rom, const Job& job)
+{
+    RAM ram(MEMORY_SIZE_BYTES);
+    MEMC memory_controler(rom, &ram);
+    memory_controler.loadRAM(job.ram.data(), job.ram.size());
+
+    CPU<NoTrace> cpu(&memory_controler);
+    CPUState state = {};
+    for(int i = 0; i < REGISTER_COUNT; i++)
+        state.registers[i] = job.registers[i];
+    cpu.setState(state);
+
+    JobResult result;
+    result.executed = cpu.run(job.budget);
+    result.state = cpu.getState();
+    result.reason = GetHaltReason(result.state);
+    result.fault = result.reason == HALT_FAULT ? result.state.trapCause : uint32_t(FAULT_NONE);
+    return result;
+}
+
+bool SameResult(const JobResult& a, const JobResult& b)
+{
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        if(a.state.registers[i] != b.state.registers[i]) return false;
+
+    return a.state.PC == b.state.PC && a.state.HALTED == b.state.HALTED && a.state.ZF == b.state.ZF
+    && a.state.trapCause == b.state.trapCause && a.state.trapPC == b.state.trapPC && a.state.TRAPPED == b.state.TRAPPED
+    && a.reason == b.reason && a.executed == b.executed && a.fault == b.fault;
+}
+
+int main(int argc, char* argv[])
+{
+    int job_count = argc > 1 ? std::atoi(argv[1]) : DEFAULT_JOBS;
+
+    try
+    {
+        ROM rom(STORAGE_IMAGE);                 // Built into the binary, the batches don't touch the disk
+
+        // Random inputs and budgets around the length of a full run, so both halt reasons show up
+        std::mt19937 random(1);
+        std::vector<Job> jobs(job_count);
+        for(Job& job : jobs)
+        {
+            job.ram = std::vector<uint8_t>(random() % MEMORY_SIZE_BYTES);
+            for(uint8_t& byte : job.ram)
+                byte = random();
+            for(int i = 0; i < REGISTER_COUNT; i++)
+                job.registers[i] = random();
+            job.budget = 50 + random() % 100;
+        }
+
+        std::vector<JobResult> expected;
+        for(const Job& job : jobs)
+            expected.push_back(Reference(&rom, job));
+
+        unsigned cores = std::thread::hardware_concurrency();
+        if(cores == 0) cores = 1;
+
+        std::vector<unsigned> worker_counts;    // 1, 2, 4 ... and every core
+        for(unsigned workers = 1; workers < cores; workers *= 2)
+            worker_counts.push_back(workers);
+        worker_counts.push_back(cores);
+
+        double single = 0;
+        for(unsigned workers : worker_counts)
+        {
+            BatchRunner<> runner(&rom, MEMORY_SIZE_BYTES, workers);
+
+            std::vector<JobResult> results;
+            uint64_t instructions = 0;
+
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < REPETITIONS; i++)
+                results = runner.run(jobs);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            for(size_t i = 0; i < jobs.size(); i++)
+            {
+                if(!SameResult(results[i], expected[i]))
+                {
+                    std::cerr << "Job " << i << " differs from running it alone\n";
+                    return 1;
+                }
+                instructions += results[i].executed;
+            }
+
+            double jobs_per_second = (jobs.size() * REPETITIONS) / seconds;
+            if(workers == 1) single = jobs_per_second;
+
+            std::cout << workers << " workers: " << jobs_per_second / 1e6 << " M jobs/s, "
+                      << (instructions * REPETITIONS / seconds) / 1e6 << " MIPS, "
+                      << jobs_per_second / single << "x one worker\n";
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
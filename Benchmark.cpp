@@ -0,0 +1,417 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "CPU.h"
+
+// Benchmark suite: guest programs built with EncInstr, run through CPU::run on every engine
+// with tracing compiled out (NoTrace), and on the interpreters once more without loop fast
+// forwarding and once without instruction fusion. Results go to stdout and to a JSON file.
+
+const char DEFAULT_RESULTS_PATH[] = "benchmark.json";
+const double DEFAULT_MIN_SECONDS = 0.5;     // Timed runs of a workload on one engine last at least this long
+const uint32_t BENCH_ROM_BYTES = 0x8000;    // RAM starts right after, at 0x8000
+const uint32_t BENCH_RAM_BYTES = 0x8000;    // Up to 0xFFFF, all of it reachable by immediates
+
+struct Workload
+{
+    const char* name;
+    const char* description;
+    std::vector<uint32_t> program;
+};
+
+// Arithmetic and logic only, the loop counter never leaves the registers
+Workload ALU()
+{
+    return Workload{ "alu", "ADDR/LSL/ORR/ANDI loop, 1M iterations",
+    {
+        EncInstr(MVI, 0, 0, 0),             // 0   Accumulator
+        EncInstr(MVI, 1, 0, 0x3D09),        // 1   Iterations, 0x3D09 << 6 = 1000000
+        EncInstr(LSL, 1, 0, 6),             // 2
+        EncInstr(MVI, 2, 0, 0),             // 3   Zero to compare with
+        EncInstr(MVI, 3, 0, 0x1234),        // 4   Mixed into the accumulator
+        EncInstr(ADDR, 0, 3),               // 5   0x14 loop
+        EncInstr(LSL, 3, 0, 3),             // 6
+        EncInstr(ORR, 3, 0),                // 7
+        EncInstr(ANDI, 3, 0, 0x7FFF),       // 8
+        EncInstr(SUBI, 1, 0, 1),            // 9
+        EncInstr(CMP, 1, 2),                // 10
+        EncInstr(JNZ, 0, 0, 0x14),          // 11
+        EncInstr(HLT, 0, 0)                 // 12
+    }};
+}
+
+// Streams the first half of RAM into the second half, adding one to every word
+Workload Stream()
+{
+    return Workload{ "stream", "LOADR/STORER over 16 KB of RAM, 100 passes",
+    {
+        EncInstr(MVI, 1, 0, 100),           // 0   Passes
+        EncInstr(MVI, 3, 0, 0xC000),        // 1   End of the source half
+        EncInstr(MVI, 0, 0, 0x8000),        // 2   0x08 pass, source pointer
+        EncInstr(LOADR, 2, 0),              // 3   0x0C word
+        EncInstr(ADDI, 2, 0, 1),            // 4
+        EncInstr(ADDI, 0, 0, 0x4000),       // 5   Same word in the destination half
+        EncInstr(STORER, 2, 0),             // 6
+        EncInstr(SUBI, 0, 0, 0x3FFC),       // 7   Next source word
+        EncInstr(CMP, 0, 3),                // 8
+        EncInstr(JNZ, 0, 0, 0x0C),          // 9
+        EncInstr(MVI, 2, 0, 0),             // 10
+        EncInstr(SUBI, 1, 0, 1),            // 11
+        EncInstr(CMP, 1, 2),                // 12
+        EncInstr(JNZ, 0, 0, 0x08),          // 13
+        EncInstr(HLT, 0, 0)                 // 14
+    }};
+}
+
+// Three data dependent branches per iteration on bits of a pseudo random number
+Workload Branch()
+{
+    return Workload{ "branch", "LCG with 3 data dependent branches, 250k iterations",
+    {
+        EncInstr(MVI, 0, 0, 1),             // 0   Random state
+        EncInstr(MVI, 1, 0, 0x7A12),        // 1   Iterations, 0x7A12 << 3 = 250000
+        EncInstr(LSL, 1, 0, 3),             // 2
+        EncInstr(MVI, 2, 0, 0),             // 3   Zero to compare with
+        EncInstr(MVR, 3, 0),                // 4   0x10 loop, state = state * 33 + 12345
+        EncInstr(LSL, 3, 0, 5),             // 5
+        EncInstr(ADDR, 0, 3),               // 6
+        EncInstr(ADDI, 0, 0, 0x3039),       // 7
+        EncInstr(MVR, 3, 0),                // 8
+        EncInstr(ANDI, 3, 0, 0x400),        // 9
+        EncInstr(CMP, 3, 2),                // 10
+        EncInstr(JZ, 0, 0, 0x34),           // 11
+        EncInstr(ADDI, 0, 0, 7),            // 12
+        EncInstr(MVR, 3, 0),                // 13  0x34
+        EncInstr(ANDI, 3, 0, 0x2000),       // 14
+        EncInstr(CMP, 3, 2),                // 15
+        EncInstr(JNZ, 0, 0, 0x48),          // 16
+        EncInstr(SUBI, 0, 0, 3),            // 17
+        EncInstr(MVR, 3, 0),                // 18  0x48
+        EncInstr(ANDI, 3, 0, 0x8000),       // 19
+        EncInstr(CMP, 3, 2),                // 20
+        EncInstr(JZ, 0, 0, 0x5C),           // 21
+        EncInstr(ORI, 0, 0, 1),             // 22
+        EncInstr(SUBI, 1, 0, 1),            // 23  0x5C
+        EncInstr(CMP, 1, 2),                // 24
+        EncInstr(JNZ, 0, 0, 0x10),          // 25
+        EncInstr(HLT, 0, 0)                 // 26
+    }};
+}
+
+// Copies a small program into RAM like the bootloader, runs it, and starts over. Every copy
+// writes over code that was already decoded (or translated), so the code caches keep dropping it.
+Workload SelfModifying()
+{
+    return Workload{ "selfmod", "bootloader style copy into RAM and run, 2000 passes",
+    {
+        EncInstr(LOADI, 1, 0, 0xF000),      // 0   Passes so far, kept in RAM
+        EncInstr(ADDI, 1, 0, 1),            // 1
+        EncInstr(STOREI, 1, 0, 0xF000),     // 2
+        EncInstr(MVI, 2, 0, 2000),          // 3
+        EncInstr(CMP, 1, 2),                // 4
+        EncInstr(JZ, 0, 0, 0x48),           // 5
+        EncInstr(MVI, 0, 0, 0x8000),        // 6   RAM program adress
+        EncInstr(MVI, 1, 0, 0x4C),          // 7   ROM program adress
+        EncInstr(MVI, 3, 0, 0xFF),          // 8   End marker
+        EncInstr(LOADR, 2, 1),              // 9   0x24 copy
+        EncInstr(STORER, 2, 0),             // 10
+        EncInstr(ADDI, 1, 0, 4),            // 11
+        EncInstr(ADDI, 0, 0, 4),            // 12
+        EncInstr(LOADR, 2, 1),              // 13
+        EncInstr(ANDI, 2, 0, 0xFF),         // 14
+        EncInstr(CMP, 2, 3),                // 15
+        EncInstr(JNZ, 0, 0, 0x24),          // 16
+        EncInstr(JMP, 0, 0, 0x8000),        // 17
+        EncInstr(HLT, 0, 0),                // 18  0x48
+
+        // Program copied to 0x8000
+        EncInstr(MVI, 0, 0, 0),             // 19  0x4C
+        EncInstr(MVI, 1, 0, 50),            // 20
+        EncInstr(MVI, 2, 0, 0),             // 21
+        EncInstr(ADDI, 2, 0, 3),            // 22  0x800C
+        EncInstr(SUBI, 1, 0, 1),            // 23
+        EncInstr(CMP, 1, 0),                // 24
+        EncInstr(JNZ, 0, 0, 0x800C),        // 25
+        EncInstr(JMP, 0, 0, 0x0000),        // 26
+        0xFFFFFFFF                          // 27  End marker
+    }};
+}
+
+// A counted loop, the ADDR adds the same register every iteration
+Workload Multiply()
+{
+    return Workload{ "multiply", "ADDR/ADDI counted loop, 4M iterations",
+    {
+        EncInstr(MVI, 0, 0, 0),             // 0   Product
+        EncInstr(MVI, 1, 0, 0),             // 1   Counter
+        EncInstr(MVI, 2, 0, 0x3D09),        // 2   Iterations, 0x3D09 << 8 = 4000000
+        EncInstr(LSL, 2, 0, 8),             // 3
+        EncInstr(MVI, 3, 0, 0x2F),          // 4   Factor
+        EncInstr(ADDR, 0, 3),               // 5   0x14 loop
+        EncInstr(ADDI, 1, 0, 1),            // 6
+        EncInstr(CMP, 1, 2),                // 7
+        EncInstr(JNZ, 0, 0, 0x14),          // 8
+        EncInstr(HLT, 0, 0)                 // 9
+    }};
+}
+
+// A loop with an ADDR and a SUBR that cancel, of a register the loop writes. Its step changes
+// every iteration, so it isn't a counted loop and every engine has to agree with the unforwarded one.
+Workload Cancel()
+{
+    return Workload{ "cancel", "SUBR/ADDR of a written register in a loop, 1M iterations",
+    {
+        EncInstr(MVI, 0, 0, 0),             // 0
+        EncInstr(MVI, 1, 0, 0x3D09),        // 1   Iterations, 0x3D09 << 6 = 1000000
+        EncInstr(LSL, 1, 0, 6),             // 2
+        EncInstr(MVI, 2, 0, 0),             // 3   Zero to compare with
+        EncInstr(SUBR, 0, 0),               // 4   0x10 loop, R0 = 0
+        EncInstr(ADDR, 0, 0),               // 5
+        EncInstr(SUBI, 0, 0, 0xBAFA),       // 6   R0 = 0xFFFF4506 after every iteration
+        EncInstr(SUBI, 1, 0, 1),            // 7
+        EncInstr(CMP, 1, 2),                // 8
+        EncInstr(JNZ, 0, 0, 0x10),          // 9
+        EncInstr(HLT, 0, 0)                 // 10
+    }};
+}
+
+// Writes over RAM words only the interpreter runs (COREID, an illegal word) from ROM code and runs
+// them again. The JIT has to hand those stores to the interpreter too, or the CPU keeps the old decoding.
+Workload Patch()
+{
+    return Workload{ "patch", "COREID replaced by GETTRAP between two runs of it, 1000 passes",
+    {
+        EncInstr(LOADI, 1, 0, 0xF000),      // 0   Passes so far, kept in RAM
+        EncInstr(ADDI, 1, 0, 1),            // 1
+        EncInstr(STOREI, 1, 0, 0xF000),     // 2
+        EncInstr(MVI, 2, 0, 1000),          // 3
+        EncInstr(CMP, 1, 2),                // 4
+        EncInstr(JZ, 0, 0, 0x68),           // 5
+        EncInstr(LOADI, 3, 0, 0x70),        // 6   COREID at 0x8100
+        EncInstr(STOREI, 3, 0, 0x8100),     // 7
+        EncInstr(LOADI, 3, 0, 0x74),        // 8   Illegal word at 0x8104, traps back to ROM
+        EncInstr(STOREI, 3, 0, 0x8104),     // 9
+        EncInstr(MVI, 0, 0, 0),             // 10  First run
+        EncInstr(SETTRAP, 0, 0, 0x34),      // 11
+        EncInstr(JMP, 0, 0, 0x8100),        // 12
+        EncInstr(MVI, 3, 0, 0),             // 13  0x34 trap handler
+        EncInstr(CMP, 0, 3),                // 14
+        EncInstr(JNZ, 0, 0, 0x58),          // 15
+        EncInstr(MVI, 0, 0, 1),             // 16  Second run, with GETTRAP at 0x8100
+        EncInstr(LOADI, 3, 0, 0x78),        // 17
+        EncInstr(STOREI, 3, 0, 0x8100),     // 18
+        EncInstr(SETTRAP, 0, 0, 0x34),      // 19
+        EncInstr(JMP, 0, 0, 0x8100),        // 20
+        EncInstr(NOP, 0, 0),                // 21
+        EncInstr(LOADI, 3, 0, 0xF004),      // 22  0x58 sum of the trap causes GETTRAP read
+        EncInstr(ADDR, 3, 2),               // 23
+        EncInstr(STOREI, 3, 0, 0xF004),     // 24
+        EncInstr(JMP, 0, 0, 0x0000),        // 25
+        EncInstr(LOADI, 3, 0, 0xF004),      // 26  0x68
+        EncInstr(HLT, 0, 0),                // 27
+        EncInstr(COREID, 2, 0),             // 28  0x70
+        0xFFFFFFFF,                         // 29  0x74
+        EncInstr(GETTRAP, 2, 3)             // 30  0x78
+    }};
+}
+
+// The bootloader copy loop over 16 KB of ROM data up to its end marker, again and again
+Workload Copy()
+{
+    std::vector<uint32_t> program =
+    {
+        EncInstr(LOADI, 1, 0, 0xF000),      // 0   Passes so far, kept in RAM
+        EncInstr(ADDI, 1, 0, 1),            // 1
+        EncInstr(STOREI, 1, 0, 0xF000),     // 2
+        EncInstr(MVI, 2, 0, 100),           // 3
+        EncInstr(CMP, 1, 2),                // 4
+        EncInstr(JZ, 0, 0, 0x48),           // 5
+        EncInstr(MVI, 0, 0, 0x8000),        // 6   RAM adress
+        EncInstr(MVI, 1, 0, 0x100),         // 7   ROM data adress
+        EncInstr(MVI, 3, 0, 0xFF),          // 8   End marker
+        EncInstr(LOADR, 2, 1),              // 9   0x24 copy
+        EncInstr(STORER, 2, 0),             // 10
+        EncInstr(ADDI, 1, 0, 4),            // 11
+        EncInstr(ADDI, 0, 0, 4),            // 12
+        EncInstr(LOADR, 2, 1),              // 13
+        EncInstr(ANDI, 2, 0, 0xFF),         // 14
+        EncInstr(CMP, 2, 3),                // 15
+        EncInstr(JNZ, 0, 0, 0x24),          // 16
+        EncInstr(JMP, 0, 0, 0x0000),        // 17
+        EncInstr(HLT, 0, 0)                 // 18  0x48
+    };
+    program.resize(0x100 / 4, 0);
+    program.insert(program.end(), 0x1000, 0x11);    // 0x100 data
+    program.push_back(0xFFFFFFFF);                  // 0x4100 end marker
+
+    return Workload{ "copy", "sentinel copy of 16 KB from ROM to RAM, 100 passes", program };
+}
+
+struct Result
+{
+    std::string workload;
+    std::string engine;
+    uint64_t instructions;                  // Per run
+    uint64_t fused;                         // Per run, dispatches saved by fused pairs
+    uint64_t forwarded;                     // Per run, instructions of fast forwarded loop iterations
+    int runs;
+    double startupMicroseconds;             // ROM, RAM, MEMC and CPU construction
+    double seconds;                         // All timed runs
+    double minRunMilliseconds;
+    double medianRunMilliseconds;
+    CPUState state;
+};
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result Run(const Workload& workload, const std::vector<uint8_t>& image, Engine engine, const char* engine_name, bool fusion, bool fast_forward, double min_seconds)
+{
+    Result result;
+    result.workload = workload.name;
+    result.engine = engine_name;
+
+    auto start = std::chrono::steady_clock::now();
+    ROM rom(image.data(), image.size());
+    RAM ram(BENCH_RAM_BYTES);
+    MEMC memory_controler(&rom, &ram);
+    CPU<NoTrace> cpu(&memory_controler, engine);
+    cpu.setFusion(fusion);
+    cpu.setFastForward(fast_forward);
+    result.startupMicroseconds = Seconds(start) * 1e6;
+
+    // The instruction count doesn't depend on the engine, count it on the handler core
+    {
+        RAM count_ram(BENCH_RAM_BYTES);
+        MEMC count_memory(&rom, &count_ram);
+        CPU<NoTrace> counter(&count_memory);
+        result.instructions = counter.run(UNLIMITED_BUDGET);
+    }
+
+    std::vector<double> runs;
+    result.seconds = 0;
+    while(result.seconds < min_seconds)
+    {
+        memory_controler.loadRAM(nullptr, 0);       // Every run starts from zeroed RAM
+        cpu.reset();
+
+        start = std::chrono::steady_clock::now();
+        cpu.run();
+        double seconds = Seconds(start);
+
+        result.seconds += seconds;
+        runs.push_back(seconds * 1e3);
+    }
+
+    std::sort(runs.begin(), runs.end());
+    result.runs = runs.size();
+    result.fused = cpu.getFused() / runs.size();
+    result.forwarded = cpu.getForwarded() / runs.size();
+    result.minRunMilliseconds = runs.front();
+    result.medianRunMilliseconds = runs[runs.size() / 2];
+    result.state = cpu.getState();
+    return result;
+}
+
+bool SameState(const CPUState& a, const CPUState& b)
+{
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        if(a.registers[i] != b.registers[i]) return false;
+
+    return a.PC == b.PC && a.HALTED == b.HALTED && a.ZF == b.ZF;
+}
+
+void WriteJSON(const char* path, const std::vector<Result>& results)
+{
+    std::ofstream out(path);
+    if(!out) throw std::runtime_error("Failed to open " + std::string(path));
+
+    out << "{\n  \"benchmarks\": [\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        double instructions = double(r.instructions) * r.runs;
+
+        out << "    {\"workload\": \"" << r.workload << "\", \"engine\": \"" << r.engine << "\""
+            << ", \"instructions_per_run\": " << r.instructions
+            << ", \"dispatches_per_run\": " << r.instructions - r.fused - r.forwarded
+            << ", \"forwarded_per_run\": " << r.forwarded
+            << ", \"runs\": " << r.runs
+            << ", \"startup_us\": " << r.startupMicroseconds
+            << ", \"mips\": " << (instructions / r.seconds) / 1e6
+            << ", \"ns_per_instruction\": " << (r.seconds * 1e9) / instructions
+            << ", \"run_ms_min\": " << r.minRunMilliseconds
+            << ", \"run_ms_median\": " << r.medianRunMilliseconds << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    const char* results_path = argc > 1 ? argv[1] : DEFAULT_RESULTS_PATH;
+    double min_seconds = argc > 2 ? std::atof(argv[2]) : DEFAULT_MIN_SECONDS;
+
+    struct { Engine engine; const char* name; bool fusion; bool fastForward; } engines[] =
+    {
+        { ENGINE_HANDLER, "handler", true, true },
+        { ENGINE_THREADED, "threaded", true, true },
+        { ENGINE_JIT, "jit", true, true },
+        { ENGINE_HANDLER, "handler-unforwarded", true, false },
+        { ENGINE_THREADED, "threaded-unforwarded", true, false },
+        { ENGINE_HANDLER, "handler-unfused", false, false },
+        { ENGINE_THREADED, "threaded-unfused", false, false }
+    };
+
+    try
+    {
+        std::vector<Result> results;
+
+        for(const Workload& workload : { ALU(), Stream(), Branch(), SelfModifying(), Multiply(), Copy(), Cancel(), Patch() })
+        {
+            std::vector<uint8_t> image = ImageBytes(workload.program, BENCH_ROM_BYTES);
+            std::cout << workload.name << ": " << workload.description << '\n';
+
+            size_t first = results.size();         // Result of the first engine on this workload
+            for(auto& engine : engines)
+            {
+                Result result = Run(workload, image, engine.engine, engine.name, engine.fusion, engine.fastForward, min_seconds);
+                double instructions = double(result.instructions) * result.runs;
+
+                std::cout << "  " << engine.name << ": " << (instructions / result.seconds) / 1e6 << " MIPS, "
+                          << (result.seconds * 1e9) / instructions << " ns/instruction, "
+                          << result.medianRunMilliseconds << " ms per run, startup " << result.startupMicroseconds << " us\n";
+
+                if(results.size() > first && !SameState(result.state, results[first].state))
+                    throw std::runtime_error(std::string("Engines disagree on the final state of ") + workload.name);
+
+                results.push_back(result);
+            }
+
+            const Result& handler = results[first];
+            std::cout << "  fusion removes " << handler.fused << " of " << handler.instructions << " dispatches ("
+                      << (100.0 * handler.fused) / handler.instructions << "%), fast forwarding skips "
+                      << handler.forwarded << " instructions (" << (100.0 * handler.forwarded) / handler.instructions << "%)\n";
+        }
+
+        WriteJSON(results_path, results);
+        std::cout << "Results written to " << results_path << '\n';
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
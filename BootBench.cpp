@@ -0,0 +1,81 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "Bootloader.h"
+#include "Snapshot.h"
+
+// Boot time of the copy loop bootloader against the DMA bootloader, for programs of a few sizes.
+// The programs are a HLT followed by filler words, so a run is the boot and one instruction.
+
+const int DEFAULT_RUNS = 2000;
+const size_t BOOT_RAM_BYTES = 0x4000;       // RAM ends at 0xC000, below the DMA registers
+
+template<size_t N>
+std::vector<uint8_t> Image(const std::array<uint32_t, N>& bootloader, uint32_t program_bytes)
+{
+    std::vector<uint32_t> words(bootloader.begin(), bootloader.end());
+    words.resize(BOOT_PROGRAM_ADRESS / 4, 0xFFFFFFFF);
+    words.push_back(EncInstr(HLT, 0, 0));
+    words.resize(BOOT_PROGRAM_ADRESS / 4 + program_bytes / 4, 0x11);    // Low byte isn't 0xFF, the copy loop goes on
+    return ImageBytes(words, STORAGE_SIZE_BYTES);
+}
+
+struct Boot
+{
+    uint64_t instructions;
+    double microseconds;
+};
+
+// Boots the same machine again and again, each boot copies the whole program over its last copy
+Boot Time(const std::vector<uint8_t>& image, bool fast_forward, int runs)
+{
+    ROM rom(image.data(), image.size());
+    Machine<NoTrace> machine(&rom, BOOT_RAM_BYTES);
+    CPU<NoTrace>& cpu = machine.getCPU();
+    cpu.setFastForward(fast_forward);
+
+    Boot boot;
+    boot.instructions = cpu.run(UNLIMITED_BUDGET);
+    if(!cpu.getState().HALTED || cpu.getState().PC != BOOT_RAM_ADRESS)
+        throw std::runtime_error("Didn't boot into the program");
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++)
+    {
+        cpu.reset();
+        cpu.run();
+    }
+    boot.microseconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e6 / runs;
+    return boot;
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = argc > 1 ? std::atoi(argv[1]) : DEFAULT_RUNS;
+
+    try
+    {
+        for(uint32_t program_bytes : { 0x40u, 0x400u, 0x3F00u })
+        {
+            Boot loop = Time(Image(LoopBootloader(), program_bytes), false, runs);
+            Boot forwarded = Time(Image(LoopBootloader(), program_bytes), true, runs);
+            Boot dma = Time(Image(DMABootloader(program_bytes), program_bytes), true, runs);
+
+            std::cout << program_bytes << " byte program:\n";
+            std::cout << "  copy loop              : " << loop.instructions << " instructions, " << loop.microseconds << " us per boot\n";
+            std::cout << "  copy loop fast forward : " << forwarded.instructions << " instructions, " << forwarded.microseconds << " us per boot\n";
+            std::cout << "  DMA                    : " << dma.instructions << " instructions, " << dma.microseconds << " us per boot, "
+                      << loop.microseconds / dma.microseconds << "x faster than the loop\n";
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
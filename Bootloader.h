@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Assembler.h"
+#include "DMA.h"
+
+const uint32_t BOOT_PROGRAM_ADRESS = 0x80;      // Program in ROM, right after the bootloader
+const uint32_t BOOT_RAM_ADRESS = 0x8000;        // Where it is copied to and started
+
+// Copies the program one word per loop iteration, up to the first word whose low byte is 0xFF
+constexpr std::array<uint32_t, 17> LoopBootloader()
+{
+    return Assemble(0x0,
+    {
+        // Set registers
+        Op(MVI, 0, 0, BOOT_RAM_ADRESS),                 // 0   RAM first adress
+        Op(MVI, 1, 0, BOOT_PROGRAM_ADRESS),             // 1   ROM program adress
+        Op(MVI, 2, 0, 0x00),                            // 2   Load register
+        Op(MVI, 3, 0, 0xFF),                            // 3   Stop loop thing
+
+        // Load program to RAM
+        Op(LOADR, 2, 1).label("copy"),                  // 4   LOAD instruction from ROM in R2
+        Op(STORER, 2, 0),                               // 5   STORE instruction from ROM in RAM
+        Op(ADDI, 1, 0, 4),                              // 6   Increment ROM adress
+        Op(ADDI, 0, 0, 4),                              // 7   Increment RAM adress
+        Op(LOADR, 2, 1),                                // 8   Load new memory adress
+        Op(ANDI, 2, 0, 0xFF),                           // 9   Get just the first byte
+        Op(CMP, 2, 3),                                  // 10  Compare the new addres value to see if the program is finished
+        Op(JNZ, 0, 0, Target("copy")),                  // 11  Loop until program is finished
+
+        // Reset the registeres
+        Op(MVI, 0, 0, 0x00),                            // 12
+        Op(MVI, 1, 0, 0x00),                            // 13
+        Op(MVI, 2, 0, 0x00),                            // 14
+        Op(MVI, 3, 0, 0x00),                            // 15
+
+        // Start program
+        Op(JMP, 0, 0, BOOT_RAM_ADRESS)                  // 16  Jump to memory program
+    });
+}
+
+// Has the DMA controller copy program_bytes in one transfer and waits for it. A refused transfer
+// stops at the HLT instead of starting the program.
+constexpr std::array<uint32_t, 19> DMABootloader(uint32_t program_bytes)
+{
+    return Assemble(0x0,
+    {
+        // Program the transfer
+        Op(MVI, 0, 0, BOOT_PROGRAM_ADRESS),                     // 0
+        Op(STOREI, 0, 0, DMA_BASE + DMA_SOURCE),                // 1
+        Op(MVI, 0, 0, BOOT_RAM_ADRESS),                         // 2
+        Op(STOREI, 0, 0, DMA_BASE + DMA_DESTINATION),           // 3
+        Op(MVI, 0, 0, program_bytes),                           // 4
+        Op(STOREI, 0, 0, DMA_BASE + DMA_LENGTH),                // 5
+        Op(MVI, 0, 0, DMA_START),                               // 6
+        Op(STOREI, 0, 0, DMA_BASE + DMA_CONTROL),               // 7   Start it
+
+        // Wait until it is done
+        Op(MVI, 1, 0, 0),                                       // 8   Zero to compare with
+        Op(LOADI, 0, 0, DMA_BASE + DMA_CONTROL).label("wait"),  // 9   status
+        Op(ANDI, 0, 0, DMA_BUSY),                               // 10
+        Op(CMP, 0, 1),                                          // 11
+        Op(JNZ, 0, 0, Target("wait")),                          // 12  Still busy
+        Op(LOADI, 0, 0, DMA_BASE + DMA_CONTROL),                // 13
+        Op(ANDI, 0, 0, DMA_ERROR),                              // 14
+        Op(CMP, 0, 1),                                          // 15
+        Op(JNZ, 0, 0, Target("refused")),                       // 16
+
+        // Start program, R0 and R1 are zero again and R2, R3 were never used
+        Op(JMP, 0, 0, BOOT_RAM_ADRESS),                         // 17
+        Op(HLT, 0, 0).label("refused")                          // 18
+    });
+}
+
+// A ROM image of the bootloader followed by the program at BOOT_PROGRAM_ADRESS, the rest padded
+// with 0xFF bytes like ImageBytes() does
+template<size_t BOOT, size_t PROGRAM>
+constexpr std::array<uint32_t, STORAGE_SIZE_BYTES / 4> BootImage(const std::array<uint32_t, BOOT>& bootloader, const std::array<uint32_t, PROGRAM>& program)
+{
+    static_assert(BOOT * 4 <= BOOT_PROGRAM_ADRESS, "The bootloader runs into the program");
+
+    std::array<uint32_t, STORAGE_SIZE_BYTES / 4> image = Padding<STORAGE_SIZE_BYTES / 4>();
+    Place(image, 0x0, bootloader);
+    Place(image, BOOT_PROGRAM_ADRESS, program);
+    return image;
+}
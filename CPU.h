@@ -1,212 +1,1029 @@
+#pragma once
+
 #include <iostream>
 #include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include <unordered_map>
 
 #include "MemoryControler.h"
 #include "Instructions.h"
+#include "Trace.h"
+#include "JIT.h"
+#include "Loop.h"
+
+// Interpreter cores, picked when the CPU is constructed
+enum Engine
+{
+    ENGINE_HANDLER,     // Loop that calls the decoded handler of every instruction
+    ENGINE_THREADED,    // Threaded code, every handler dispatches the next instruction itself
+    ENGINE_JIT          // Basic blocks translated to x86-64 code (ENGINE_THREADED where there is no JIT)
+};
+
+// Architectural state of a CPU, everything a guest program can observe besides memory
+struct CPUState
+{
+    uint32_t registers[REGISTER_COUNT];
+    uint32_t PC;
+    bool HALTED;
+    bool ZF;
+    uint32_t trapCause;     // Fault of the last trap, FAULT_NONE once GETTRAP read it
+    uint32_t trapPC;        // PC of the instruction that trapped
+    uint32_t trapHandler;   // Adress traps go to, 0 when they halt the CPU
+    bool TRAPPED;           // Halted by a trap without a handler rather than by HLT
+};
 
-const int REGISTER_COUNT = 4;
+const uint8_t ILLEGAL_OPERATION = 0xFF;  // Operation of decoded instructions that can't run
 
-class CPU
+// Pseudo operations of fused pairs, made by the decoder out of two instructions and never seen by the guest
+const uint8_t FUSED_CMP_JZ = 0xF0;       // CMP then JZ, compare and branch
+const uint8_t FUSED_CMP_JNZ = 0xF1;      // CMP then JNZ
+const uint8_t FUSED_ADDI_ADDI = 0xF2;    // Two ADDI, like the two pointer increments of a copy loop
+const uint8_t FUSED_LOADR_ANDI = 0xF3;   // LOADR then ANDI, load and mask
+
+const int DECODE_PAGE_BITS = 12;         // Decoded instructions are kept per 4 KB of guest code
+const uint32_t DECODE_PAGE_ENTRIES = 1 << (DECODE_PAGE_BITS - 2);
+const int TAIL_CHAIN_LENGTH = 256;      // Tail calls before the portable threaded core unwinds to its trampoline
+const uint64_t UNLIMITED_BUDGET = ~uint64_t(0);
+
+// CPU in run() on this host thread. Over a shared MEMC only it drops code it writes right away,
+// what other cores write over its code waits for its next atomic or run().
+inline thread_local const CodeCache* RunningCPU = nullptr;
+
+template<typename TracePolicy = NoTrace>
+class CPU : public CodeCache
 {
 private:
+    // An instruction split into its operation handler and operands, cached per PC
+    struct DecodedInstr
+    {
+        void (CPU::*handler)(const DecodedInstr&);  // Operation handler, nullptr while the entry is empty
+        uint32_t instruction;                       // Raw instruction word
+        uint8_t operation;
+        uint8_t registerA;
+        uint8_t registerB;
+        uint16_t immediate;
+        uint8_t secondA;                            // Operands of the second instruction of a fused pair
+        uint16_t secondImmediate;
+        mutable bool loop;                          // CMP + JNZ closing a loop that may be fast forwarded
+        uint8_t fault;                              // Trap cause of an ILLEGAL_OPERATION entry
+    };
+
+    // A loop analysed at its CMP, good until code anywhere gets written
+    struct Loop
+    {
+        LoopShape shape;
+        uint64_t epoch;
+    };
+
     uint32_t registers[REGISTER_COUNT]; // Registers
     MEMC* memory;                       // Memory Controler
+    TracePolicy trace;                  // Tracing policy (NoTrace, SummaryTrace, FullTrace, ProfileTrace)
+    Engine engine;                      // Interpreter core used by run()
+#ifdef CPU_HAS_JIT
+    std::unique_ptr<JIT> jit;           // Block translator for ENGINE_JIT
+#endif
+
+    // Decoded instruction cache, one entry per aligned word. Pages are made when code in them first
+    // runs, so the cache grows with the code that runs and not with the size of ROM and RAM.
+    std::unordered_map<uint32_t, std::unique_ptr<DecodedInstr[]>> decoded;
+    DecodedInstr* decodedPage = nullptr;    // Page of the last fetch
+    uint32_t decodedPageNumber = ~0u;
+    DecodedInstr uncached;              // Scratch entry for unaligned PCs
 
     uint32_t PC;                        // Program Counter / Memory Address Pointer
+    uint64_t remaining;                 // Instructions left in the budget of run()
+    bool unlimited;                     // run() has no budget, a loop that never ends isn't forwarded
+    bool fusion;                        // Decode common pairs into one fused entry (NoTrace only)
+    uint64_t fused = 0;                 // Second halves of fused pairs run, the dispatches fusion saved
+    bool fastForward;                   // Run counted and copy loops in one go (needs fusion)
+    uint64_t forwarded = 0;             // Instructions of fast forwarded loop iterations
+    std::unordered_map<uint32_t, Loop> loops;   // By PC of the CMP
+    uint64_t codeEpoch = 0;             // Counts invalidations, analysed loops from an older epoch are redone
+
+    uint32_t coreID;                    // What COREID gives, 0 unless the CPU is one of several cores
+    std::mutex pendingLock;
+    std::vector<uint32_t> pending;      // Words other cores wrote over this CPU's code, guarded by pendingLock
+    std::atomic<bool> stale{ false };   // pending isn't empty
 
     // FLAGS
-    bool HALTED;                        // Halt Flag 
+    bool HALTED;                        // Halt Flag
     bool ZF;                            // Zero Flag
-    
-    // FUNCTIONS
-    void execute(uint32_t instruction)
-    {
-        uint8_t operation = (instruction >> 24) & 0xFF; // shift 24 bits to the right then keep the last 8 bits
-        uint8_t registerA = (instruction >> 20) & 0xF;  // shift 20 bits to the right then keep the last 4 bits
-        uint8_t registerB = (instruction >> 16) & 0xF;  // shift 16 bits to the right then keep the last 4 bits
-        uint16_t immediate = instruction & 0xFFFF;      // keep the last 16 bits
 
-        switch (operation)
+    // TRAPS. A fault of an instruction (memory access, illegal instruction) doesn't unwind the host,
+    // the instruction leaves its registers alone and the CPU goes to the trap handler or halts.
+    uint32_t trapCause;                 // Fault of the last trap
+    uint32_t trapPC;                    // PC of the instruction that trapped
+    uint32_t trapHandler;               // Adress traps go to, 0 when they halt the CPU
+    bool TRAPPED;                       // Halted by a trap, trapCause may be left from one a handler took
+
+    // Record the fault of the instruction at PC and go to the handler, or halt when there is none.
+    // Taking a trap disarms the handler, so a fault inside it halts unless it set itself again.
+    void trap(uint32_t cause)
+    {
+        trapCause = cause;
+        trapPC = PC;
+        if(trapHandler)
         {
-        case MVR:       
-            registers[registerA] = registers[registerB];                        // Move/Set a register to another regsiter RA = RB
-            PC += 4;                                                            // Move the program counter to the next instruction
+            PC = trapHandler;
+            trapHandler = 0;
+        }
+        else
+        {
+            HALTED = true;
+            TRAPPED = true;
+        }
+    }
 
-            std::cout << "MVR -> R" << int(registerA) << "[" << registers[registerA] << "] = R" << int(registerB) << "[" << registers[registerB] << "]\n";  
+    // OPERATIONS
+    void opMVR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] = registers[instr.registerB];                // Move/Set a register to another regsiter RA = RB
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;      
-        case ADDR:       
-            registers[registerA] += registers[registerB];                       // Add a register to another register RA += RB
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opADDR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] += registers[instr.registerB];               // Add a register to another register RA += RB
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "ADDR -> R" << int(registerA) << "[" << registers[registerA] << "] += R" << int(registerB) << "[" << registers[registerB] << "]\n";  
+    void opSUBR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] -= registers[instr.registerB];               // Subtract a regiter from the other register RA -= RB
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;      
-        case SUBR:       
-            registers[registerA] -= registers[registerB];                       // Subtract a regiter from the other register RA -= RB
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opMVI(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] = instr.immediate;                           // Set a register to an immediate RA = imm
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "SUBR -> R" << int(registerA) << "[" << registers[registerA] << "] -= R" << int(registerB) << "[" << registers[registerB] << "]\n";  
+    void opADDI(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] += instr.immediate;                          // Add an immediate to a register RB += imm
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case MVI:       
-            registers[registerA] = immediate;                                   // Set a register to an immediate RA = imm
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opSUBI(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] -= instr.immediate;                          // Subtract a regiter from the other register RA -= imm
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "MVI -> R" << int(registerA) << "[" << registers[registerA] << "] = I[" << immediate << "]\n";  
+    void opCMP(const DecodedInstr& instr)
+    {
+        ZF = (registers[instr.registerA] == registers[instr.registerB]);        // Compare two register RA ?= RB
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;      
-        case ADDI:       
-            registers[registerA] += immediate;                                  // Add an immediate to a register RB += imm
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opJMP(const DecodedInstr& instr)
+    {
+        PC = instr.immediate;                                                   // Set the program counter to another instruction
+    }
 
-            std::cout << "ADDI -> R" << int(registerA) << "[" << registers[registerA] << "] += I[" << immediate << "]\n";  
+    void opJZ(const DecodedInstr& instr)
+    {
+        if(ZF) PC = instr.immediate;                                            // Set the program counter to other instruction if the zero flag is true
+        else PC += 4;
+    }
 
-            break;      
-        case SUBI:       
-            registers[registerA] -= immediate;                                  // Subtract a regiter from the other register RA -= imm
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opJNZ(const DecodedInstr& instr)
+    {
+        if(!ZF) PC = instr.immediate;                                           // Set the program counter to other instruction if the zero flag is false
+        else PC += 4;
+    }
 
-            std::cout << "SUBI -> R" << int(registerA) << "[" << registers[registerA] << "] -= I[" << immediate << "]\n";  
+    void opHLT(const DecodedInstr& /*instr*/)
+    {
+        HALTED = true;                                                          // Stop the program
+    }
 
-            break;
-        case CMP:
-            ZF = (registers[registerA] == registers[registerB]);                // Compare two register RA ?= RB 
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opLOADR(const DecodedInstr& instr)
+    {
+        uint32_t adress = registers[instr.registerB];
+        if(Fault fault = memory->load(adress, registers[instr.registerA]))      // Load some value from an adress in the memory to a register
+            return trap(fault);
+        trace.access(adress, false, adress < memory->ROM_PARTITION_END);
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "CMP -> R" << int(registerA) << "[" << registers[registerA] << "] ?= I" << int(registerB) << "[" << registers[registerB] << "]\n";  
+    void opSTORER(const DecodedInstr& instr)
+    {
+        uint32_t adress = registers[instr.registerB];
+        if(Fault fault = memory->store(adress, registers[instr.registerA]))     // Store some value from a register in memory to an adress
+            return trap(fault);
+        trace.access(adress, true, false);                                      // Only RAM takes stores
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case JMP:
-            PC = immediate;                                                     // Set the program counter to another instruction
+    void opLOADI(const DecodedInstr& instr)
+    {
+        if(Fault fault = memory->load(instr.immediate, registers[instr.registerA]))
+            return trap(fault);
+        trace.access(instr.immediate, false, instr.immediate < memory->ROM_PARTITION_END);
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "JMP -> PC = I[" << immediate << "]\n"; 
+    void opSTOREI(const DecodedInstr& instr)
+    {
+        if(Fault fault = memory->store(instr.immediate, registers[instr.registerA]))
+            return trap(fault);
+        trace.access(instr.immediate, true, false);
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case JZ:
-            if(ZF) PC = immediate;                                              // Set the program counter to other instruction if the zero flag is true  
-            else PC += 4;    
-                                 
-            std::cout << "JZ -> PC = I[" << immediate << "]\n";
+    void opANDR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] &= registers[instr.registerB];
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case JNZ:
-            if(!ZF) PC = immediate;                                             // Set the program counter to other instruction if the zero flag is false  
-            else PC += 4;    
+    void opANDI(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] &= instr.immediate;
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "JNZ -> PC = I[" << immediate << "]\n";
-                                 
-            break;
-        case HLT:
-            HALTED = true;                                                      // Stop the program
+    void opORR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] |= registers[instr.registerB];
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            std::cout << "Program halted\n";
+    void opORI(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] |= instr.immediate;
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case LOADR:
-            registers[registerA] = memory->read(registers[registerB]);          // Load some value from an adress in the memory to a register 
-            PC += 4;                                                            // Move the program counter to the next instruction
-            
-            std::cout << "LOADR -> R" << int(registerA) << " = Memory(R" << int(registerB) << "[" << registers[registerB] << "])\n";  
+    void opLSR(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] >>= (instr.immediate & 31);                  // Shift immediate bits to the right (the count wraps at 32 like on the host)
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case STORER:
-            memory->write(registers[registerB], registers[registerA]);          // Store some value from a register in memory to an adress
-            PC += 4;                                                            // Move the program counter to the next instruction
-            
-            std::cout << "STORER -> Memory(R" << int(registerB) << "[" << registers[registerB] << "])" << " = R" << int(registerA) << "[" << registers[registerA] << "]\n";                                                                              
+    void opLSL(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] <<= (instr.immediate & 31);                  // Shift immediate bits to the left (the count wraps at 32 like on the host)
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case LOADI:
-            registers[registerA] = memory->read(immediate);                     
-            PC += 4;                                                            // Move the program counter to the next instruction
-            
-            std::cout << "LOADI -> R" << int(registerA) << " = Memory(I[" << immediate << "])\n";  
+    void opNOP(const DecodedInstr& /*instr*/)
+    {
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case STOREI:
-            memory->write(immediate, registers[registerA]);                     
-            PC += 4;                                                            // Move the program counter to the next instruction
-                                   
-            std::cout << "STOREI -> Memory(I[" << immediate << "])" << " = R" << int(registerA) << "[" << registers[registerA] << "]\n";     
+    // ATOMICS. Both order this core's memory accesses with the other cores' and pick up the code
+    // they wrote before.
+    void opCAS(const DecodedInstr& instr)
+    {
+        uint32_t expected = registers[instr.registerA];
+        bool swapped;
+        if(Fault fault = memory->compareSwap(instr.immediate, expected, registers[instr.registerB], swapped))
+            return trap(fault);
+        ZF = swapped;                                                           // Swapped when memory held RA
+        registers[instr.registerA] = expected;                                  // Unchanged after a swap, what memory held otherwise
+        trace.access(instr.immediate, true, false);
+        sync();
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case ANDR:
-            registers[registerA] &= registers[registerB];
-            PC += 4;                                                            // Move the program counter to the next instruction
-                            
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] &= R" << int(registerB) << "[" << registers[registerB] << "]\n";           
-            
-            break;
-        case ANDI:
-            registers[registerA] &= immediate;             
-            PC += 4;                                                            // Move the program counter to the next instruction
-                                                                                 
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] &= I[" << immediate << "]\n";   
+    void opFADD(const DecodedInstr& instr)
+    {
+        uint32_t adress = registers[instr.registerB];
+        uint32_t old;
+        if(Fault fault = memory->fetchAdd(adress, registers[instr.registerA], old))
+            return trap(fault);
+        registers[instr.registerA] = old;                                       // Memory += RA, RA = what memory held
+        trace.access(adress, true, false);
+        sync();
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case ORR:
-            registers[registerA] |= registers[registerB];
-            PC += 4;                                                            // Move the program counter to the next instruction
-                                                                   
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] |= R" << int(registerB) << "[" << registers[registerB] << "]\n";   
+    void opCOREID(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] = coreID;                                    // Which core this is, so cores can split work
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case ORI:
-            registers[registerA] |= immediate;                                  
-            PC += 4;                                                            // Move the program counter to the next instruction
-                                                   
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] |= I[" << immediate << "]\n";   
+    void opSETTRAP(const DecodedInstr& instr)
+    {
+        trapHandler = instr.immediate;                                          // Where the next fault goes, 0 halts
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case LSR:
-            registers[registerA] >>= immediate;                                 // Shift immediate bits to the right
-            PC += 4;                                                            // Move the program counter to the next instruction
-                                                                         
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] >>= I[" << immediate << "]\n";   
+    void opGETTRAP(const DecodedInstr& instr)
+    {
+        registers[instr.registerA] = trapCause;                                 // Why the last trap was taken
+        registers[instr.registerB] = trapPC;                                    // Where it was taken
+        trapCause = FAULT_NONE;                                                 // Handled
+        PC += 4;                                                                // Move the program counter to the next instruction
+    }
 
-            break;
-        case LSL:
-            registers[registerA] <<= immediate;                                 // Shift immediate bits to the left
-            PC += 4;                                                            // Move the program counter to the next instruction
+    void opUnknown(const DecodedInstr& instr)
+    {
+        trap(instr.fault);                                                      // Illegal instruction or a PC nothing can be fetched from
+    }
 
-            std::cout << "ANDR -> R" << int(registerA) << "[" << registers[registerA] << "] <<= I[" << immediate << "]\n";   
-                                                                                        
-            break;
-        case NOP:
-            PC += 4;                                                             // Move the program counter to the next instruction
+    // FUSED PAIRS. The first instruction runs on its own handler; the second one only runs when
+    // the budget has room for it, otherwise the pair ends where two dispatches would have stopped.
+    void opCMPJZ(const DecodedInstr& instr)
+    {
+        opCMP(instr);
+        if(!remaining) return;
+        remaining--;
+        fused++;
 
-            break;
+        if(ZF) PC = instr.secondImmediate;
+        else PC += 4;
+    }
+
+    void opCMPJNZ(const DecodedInstr& instr)
+    {
+        uint32_t compare = PC;
+        opCMP(instr);
+        if(!remaining) return;
+        remaining--;
+        fused++;
+
+        if(!ZF)
+        {
+            PC = instr.secondImmediate;
+            if(instr.loop) forwardLoop(instr, compare);
+        }
+        else PC += 4;
+    }
+
+    // LOOPS. Taken back to the head of a loop, run as many whole iterations as the budget holds
+    // at once, when the loop is one of the kinds Loop.h knows. The state afterwards is the one the
+    // instructions would have left, a fault or the end of the budget stops before the iteration
+    // they fall in, which then runs instruction by instruction and traps.
+    void forwardLoop(const DecodedInstr& instr, uint32_t compare)
+    {
+        Loop& loop = loops[compare];
+        if(loop.epoch != codeEpoch + 1)
+        {
+            loop.shape = AnalyzeLoop(memory, PC, compare);
+            loop.epoch = codeEpoch + 1;         // Zero is a loop never analysed
+        }
+
+        if(loop.shape.kind == LOOP_NONE)
+        {
+            instr.loop = false;                 // Not worth asking again until it is decoded anew
+            return;
+        }
+
+        uint64_t iterations = loop.shape.kind == LOOP_COUNTED
+            ? forwardCounted(loop.shape, compare, remaining / loop.shape.length)
+            : forwardCopy(loop.shape, compare, remaining / loop.shape.length);
+
+        remaining -= iterations * loop.shape.length;
+        forwarded += iterations * loop.shape.length;
+    }
+
+    // Registers step by the same amount every iteration, so the loop ends after the first i with
+    // A + i * stepA == B + i * stepB (mod 2^32), or never
+    uint64_t forwardCounted(const LoopShape& loop, uint32_t compare, uint64_t limit)
+    {
+        uint32_t delta[REGISTER_COUNT];
+        for(int r = 0; r < REGISTER_COUNT; r++)
+        {
+            delta[r] = loop.constant[r];
+            for(int s = 0; s < REGISTER_COUNT; s++)
+                delta[r] += loop.scale[r][s] * registers[s];
+        }
+
+        uint64_t trips = TripCount(delta[loop.compareA] - delta[loop.compareB], registers[loop.compareB] - registers[loop.compareA]);
+        if(!trips && unlimited) return 0;      // Would use up the whole budget in one step, keep stepping
+        uint64_t iterations = trips ? std::min(trips, limit) : limit;
+
+        for(int r = 0; r < REGISTER_COUNT; r++)
+            registers[r] += uint32_t(iterations) * delta[r];
+
+        if(trips && iterations == trips)
+        {
+            ZF = true;
+            PC = compare + 8;
+        }
+        return iterations;
+    }
+
+    // Words are copied up to the first one whose masked value is the end marker. Nothing is done
+    // when the copy would write over its own source or over the loop.
+    uint64_t forwardCopy(const LoopShape& loop, uint32_t compare, uint64_t limit)
+    {
+        uint32_t source = registers[loop.source];
+        uint32_t destination = registers[loop.destination];
+        if(destination < memory->ROM_PARTITION_END || destination >= memory->RAM_PARTITION_END) return 0;
+
+        limit = std::min(limit, (memory->RAM_PARTITION_END - destination) / 4);    // Stores stay inside RAM
+        limit = std::min(limit, (ADRESS_SPACE_BYTES - source) / 4 - 1);            // Loads don't wrap around
+
+        uint64_t words = 0;
+        bool found = false;
+        uint32_t value, next;
+        if(memory->load(source, value)) return 0;
+        while(words < limit && !found)
+        {
+            if(memory->load(source + 4 * (words + 1), next)) break;     // The iteration with the faulting load runs on its own
+            found = (next & loop.mask) == registers[loop.end];
+            words++;
+        }
+
+        uint64_t written_end = uint64_t(destination) + 4 * words;
+        uint64_t read_end = uint64_t(source) + 4 * words + 4;
+        if(!words
+        || (destination < read_end && source < written_end)
+        || (destination < uint64_t(compare) + 8 && PC < written_end)) return 0;
+
+        memory->copy(destination, source, words);       // Can't fault, the loads went through and the stores stay in RAM
+
+        memory->load(source + 4 * (words - 1), value);
+        registers[loop.value] = value;
+        registers[loop.source] = source + 4 * words;
+        registers[loop.destination] = destination + 4 * words;
+        registers[loop.test] = next & loop.mask;
+
+        ZF = found;
+        if(found) PC = compare + 8;
+        return words;
+    }
+
+    void opADDIADDI(const DecodedInstr& instr)
+    {
+        opADDI(instr);
+        if(!remaining) return;
+        remaining--;
+        fused++;
+
+        registers[instr.secondA] += instr.secondImmediate;
+        PC += 4;
+    }
+
+    void opLOADRANDI(const DecodedInstr& instr)
+    {
+        uint32_t adress = registers[instr.registerB];
+        if(Fault fault = memory->load(adress, registers[instr.registerA]))
+            return trap(fault);                         // A faulting load leaves the pair before the ANDI
+        trace.access(adress, false, adress < memory->ROM_PARTITION_END);
+        PC += 4;
+
+        if(!remaining) return;
+        remaining--;
+        fused++;
+
+        registers[instr.secondA] &= instr.secondImmediate;
+        PC += 4;
+    }
+
+    // FUNCTIONS
+    DecodedInstr decode(uint32_t instruction) const
+    {
+        DecodedInstr instr;
+        instr.instruction = instruction;
+        instr.registerA = (instruction >> 20) & 0xF;    // shift 20 bits to the right then keep the last 4 bits
+        instr.registerB = (instruction >> 16) & 0xF;    // shift 16 bits to the right then keep the last 4 bits
+        instr.immediate = instruction & 0xFFFF;         // keep the last 16 bits
+        instr.loop = false;
+        instr.fault = FAULT_NONE;
+
+        instr.operation = (instruction >> 24) & 0xFF;  // shift 24 bits to the right then keep the last 8 bits
+
+        if(instr.registerA >= REGISTER_COUNT || instr.registerB >= REGISTER_COUNT)
+        {
+            instr.handler = &CPU::opUnknown;            // There is no such register
+            instr.operation = ILLEGAL_OPERATION;        // Threaded dispatch goes by operation
+            instr.fault = FAULT_ILLEGAL;
+            return instr;
+        }
+
+        switch (instr.operation)
+        {
+        case MVR:       instr.handler = &CPU::opMVR;        break;
+        case ADDR:      instr.handler = &CPU::opADDR;       break;
+        case SUBR:      instr.handler = &CPU::opSUBR;       break;
+        case MVI:       instr.handler = &CPU::opMVI;        break;
+        case ADDI:      instr.handler = &CPU::opADDI;       break;
+        case SUBI:      instr.handler = &CPU::opSUBI;       break;
+        case CMP:       instr.handler = &CPU::opCMP;        break;
+        case JMP:       instr.handler = &CPU::opJMP;        break;
+        case JZ:        instr.handler = &CPU::opJZ;         break;
+        case JNZ:       instr.handler = &CPU::opJNZ;        break;
+        case HLT:       instr.handler = &CPU::opHLT;        break;
+        case LOADR:     instr.handler = &CPU::opLOADR;      break;
+        case STORER:    instr.handler = &CPU::opSTORER;     break;
+        case LOADI:     instr.handler = &CPU::opLOADI;      break;
+        case STOREI:    instr.handler = &CPU::opSTOREI;     break;
+        case ANDR:      instr.handler = &CPU::opANDR;       break;
+        case ANDI:      instr.handler = &CPU::opANDI;       break;
+        case ORR:       instr.handler = &CPU::opORR;        break;
+        case ORI:       instr.handler = &CPU::opORI;        break;
+        case LSR:       instr.handler = &CPU::opLSR;        break;
+        case LSL:       instr.handler = &CPU::opLSL;        break;
+        case NOP:       instr.handler = &CPU::opNOP;        break;
+        case CAS:       instr.handler = &CPU::opCAS;        break;
+        case FADD:      instr.handler = &CPU::opFADD;       break;
+        case COREID:    instr.handler = &CPU::opCOREID;     break;
+        case SETTRAP:   instr.handler = &CPU::opSETTRAP;    break;
+        case GETTRAP:   instr.handler = &CPU::opGETTRAP;    break;
         default:
+            instr.handler = &CPU::opUnknown;
+            instr.operation = ILLEGAL_OPERATION;        // Keeps guest opcodes off the fused pseudo operations
+            instr.fault = FAULT_ILLEGAL;
             break;
         }
+
+        return instr;
     }
 
-    void PrintState() 
+    // Make instr, decoded from adress, a fused pair when it and the next instruction form one of
+    // the common idioms. Both still run in order, so the state between them is the same as before.
+    void fuse(DecodedInstr& instr, uint32_t adress)
     {
-        std::cout << "PC: " << PC << '\n';
-        std::cout << "Registers:\n";
-        for(int i = 0; i < REGISTER_COUNT; ++i)
-            std::cout << "R" << i << " = " << int(registers[i]) << '\n';
-        std::cout << '\n';
+        if(adress > ~0u - 7) return;                    // The pair would wrap around the adress space
+
+        uint32_t word;
+        if(memory->load(adress + 4, word)) return;      // Nothing there to fuse with
+        DecodedInstr second = decode(word);
+
+        if(instr.operation == CMP && second.operation == JZ)
+        {
+            instr.operation = FUSED_CMP_JZ;
+            instr.handler = &CPU::opCMPJZ;
+        }
+        else if(instr.operation == CMP && second.operation == JNZ)
+        {
+            instr.operation = FUSED_CMP_JNZ;
+            instr.handler = &CPU::opCMPJNZ;
+            instr.loop = fastForward && second.immediate < adress;     // Jumps back, closes a loop
+        }
+        else if(instr.operation == ADDI && second.operation == ADDI)
+        {
+            instr.operation = FUSED_ADDI_ADDI;
+            instr.handler = &CPU::opADDIADDI;
+        }
+        else if(instr.operation == LOADR && second.operation == ANDI)
+        {
+            instr.operation = FUSED_LOADR_ANDI;
+            instr.handler = &CPU::opLOADRANDI;
+        }
+        else return;
+
+        instr.secondA = second.registerA;
+        instr.secondImmediate = second.immediate;
+        memory->markCode(adress + 4);                   // Writes to the second word have to drop the pair too
+    }
+
+    static bool isFused(const DecodedInstr& instr)
+    {
+        return instr.operation >= FUSED_CMP_JZ && instr.operation <= FUSED_LOADR_ANDI;
+    }
+
+    DecodedInstr* findDecodedPage(uint32_t page)
+    {
+        auto found = decoded.find(page);
+        return found == decoded.end() ? nullptr : found->second.get();
+    }
+
+    const DecodedInstr& fetch()
+    {
+        if((PC & 3) == 0)                               // Aligned instructions are decoded once and reused
+        {
+            uint32_t page = PC >> DECODE_PAGE_BITS;
+            if(page != decodedPageNumber)
+            {
+                std::unique_ptr<DecodedInstr[]>& entries = decoded[page];
+                if(!entries)
+                    entries.reset(new DecodedInstr[DECODE_PAGE_ENTRIES]());
+
+                decodedPage = entries.get();
+                decodedPageNumber = page;
+            }
+
+            DecodedInstr& instr = decodedPage[(PC >> 2) & (DECODE_PAGE_ENTRIES - 1)];
+            if(!instr.handler)
+            {
+                uint32_t word;
+                if(Fault fault = memory->load(PC, word))
+                    return fetchFault(fault);
+                instr = decode(word);
+                memory->markCode(PC);                   // Writes to this word have to reach invalidate()
+                if(fusion) fuse(instr, PC);
+            }
+            return instr;
+        }
+
+        uint32_t word;
+        if(Fault fault = memory->load(PC, word))
+            return fetchFault(fault);
+        uncached = decode(word);
+        return uncached;
+    }
+
+    // Entry that traps with the fault of a fetch, not cached so the PC is fetched anew next time
+    const DecodedInstr& fetchFault(Fault fault)
+    {
+        uncached = decode(0);
+        uncached.handler = &CPU::opUnknown;
+        uncached.operation = ILLEGAL_OPERATION;
+        uncached.fault = fault;
+        return uncached;
+    }
+
+    void runHandler()
+    {
+        while (!HALTED && remaining)                                        // Execute the instruction until halt
+        {
+            remaining--;
+            uint32_t instructionPC = PC;
+            const DecodedInstr& instr = fetch();                            // Decoded instruction at the specified memory adress
+
+            (this->*instr.handler)(instr);
+
+            trace.step(instructionPC, instr.instruction, registers, ZF, PC);    // Record the instruction (empty for NoTrace)
+        }
+    }
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CPU_NO_COMPUTED_GOTO)
+    // Threaded core with labels as values. Every handler ends in its own indirect jump to the
+    // next handler, so the host branch predictor learns per operation which one usually follows.
+    void runThreaded()
+    {
+        const void* labels[256];
+        for(int i = 0; i < 256; i++)
+            labels[i] = &&UNKNOWN;
+
+        labels[MVR] = &&MVR_;       labels[MVI] = &&MVI_;       labels[ADDR] = &&ADDR_;     labels[ADDI] = &&ADDI_;
+        labels[SUBR] = &&SUBR_;     labels[SUBI] = &&SUBI_;     labels[CMP] = &&CMP_;       labels[JMP] = &&JMP_;
+        labels[JZ] = &&JZ_;         labels[JNZ] = &&JNZ_;       labels[HLT] = &&HLT_;       labels[NOP] = &&NOP_;
+        labels[LOADR] = &&LOADR_;   labels[LOADI] = &&LOADI_;   labels[STORER] = &&STORER_; labels[STOREI] = &&STOREI_;
+        labels[ANDR] = &&ANDR_;     labels[ANDI] = &&ANDI_;     labels[ORR] = &&ORR_;       labels[ORI] = &&ORI_;
+        labels[LSR] = &&LSR_;       labels[LSL] = &&LSL_;       labels[CAS] = &&CAS_;       labels[FADD] = &&FADD_;
+        labels[COREID] = &&COREID_; labels[SETTRAP] = &&SETTRAP_; labels[GETTRAP] = &&GETTRAP_;
+        labels[FUSED_CMP_JZ] = &&CMP_JZ_;           labels[FUSED_CMP_JNZ] = &&CMP_JNZ_;
+        labels[FUSED_ADDI_ADDI] = &&ADDI_ADDI_;     labels[FUSED_LOADR_ANDI] = &&LOADR_ANDI_;
+
+        if(HALTED) return;
+
+        uint32_t instructionPC;
+        const DecodedInstr* instr;
+
+        #define DISPATCH()  if(!remaining) return; remaining--; instructionPC = PC; instr = &fetch(); goto *labels[instr->operation]
+        #define NEXT()      trace.step(instructionPC, instr->instruction, registers, ZF, PC); DISPATCH()
+        #define NEXT_TRAP() trace.step(instructionPC, instr->instruction, registers, ZF, PC); if(HALTED) return; DISPATCH()
+
+        DISPATCH();
+
+        MVR_:       opMVR(*instr);      NEXT();
+        MVI_:       opMVI(*instr);      NEXT();
+        ADDR_:      opADDR(*instr);     NEXT();
+        ADDI_:      opADDI(*instr);     NEXT();
+        SUBR_:      opSUBR(*instr);     NEXT();
+        SUBI_:      opSUBI(*instr);     NEXT();
+        CMP_:       opCMP(*instr);      NEXT();
+        JMP_:       opJMP(*instr);      NEXT();
+        JZ_:        opJZ(*instr);       NEXT();
+        JNZ_:       opJNZ(*instr);      NEXT();
+        NOP_:       opNOP(*instr);      NEXT();
+        LOADR_:     opLOADR(*instr);    NEXT_TRAP();
+        LOADI_:     opLOADI(*instr);    NEXT_TRAP();
+        STORER_:    opSTORER(*instr);   NEXT_TRAP();
+        STOREI_:    opSTOREI(*instr);   NEXT_TRAP();
+        ANDR_:      opANDR(*instr);     NEXT();
+        ANDI_:      opANDI(*instr);     NEXT();
+        ORR_:       opORR(*instr);      NEXT();
+        ORI_:       opORI(*instr);      NEXT();
+        LSR_:       opLSR(*instr);      NEXT();
+        LSL_:       opLSL(*instr);      NEXT();
+        CAS_:       opCAS(*instr);      NEXT_TRAP();
+        FADD_:      opFADD(*instr);     NEXT_TRAP();
+        COREID_:    opCOREID(*instr);   NEXT();
+        SETTRAP_:   opSETTRAP(*instr);  NEXT();
+        GETTRAP_:   opGETTRAP(*instr);  NEXT();
+        CMP_JZ_:        opCMPJZ(*instr);        NEXT();
+        CMP_JNZ_:       opCMPJNZ(*instr);       NEXT();
+        ADDI_ADDI_:     opADDIADDI(*instr);     NEXT();
+        LOADR_ANDI_:    opLOADRANDI(*instr);    NEXT_TRAP();
+        UNKNOWN:    opUnknown(*instr);  NEXT_TRAP();
+        HLT_:
+            opHLT(*instr);
+            trace.step(instructionPC, instr->instruction, registers, ZF, PC);
+
+        #undef NEXT_TRAP
+        #undef NEXT
+        #undef DISPATCH
+    }
+#else
+    // Portable threaded core. Every handler tail calls the handler of the next instruction; after
+    // TAIL_CHAIN_LENGTH calls the chain returns to the trampoline so the stack stays bounded even
+    // when the compiler doesn't turn the calls into jumps.
+    typedef void (*TailHandler)(CPU&, const DecodedInstr&, int);
+
+    template<void (CPU::*handler)(const DecodedInstr&)>
+    static void tail(CPU& cpu, const DecodedInstr& instr, int chain)
+    {
+        uint32_t instructionPC = cpu.PC;
+        (cpu.*handler)(instr);
+        cpu.trace.step(instructionPC, instr.instruction, cpu.registers, cpu.ZF, cpu.PC);
+
+        if(cpu.HALTED || chain == 0 || !cpu.remaining) return;
+
+        cpu.remaining--;
+        const DecodedInstr& next = cpu.fetch();
+        return tailHandlers()[next.operation](cpu, next, chain - 1);
+    }
+
+    static const TailHandler* tailHandlers()
+    {
+        struct Table
+        {
+            TailHandler handlers[256];
+
+            Table()
+            {
+                for(int i = 0; i < 256; i++)
+                    handlers[i] = &tail<&CPU::opUnknown>;
+
+                handlers[MVR] = &tail<&CPU::opMVR>;         handlers[MVI] = &tail<&CPU::opMVI>;
+                handlers[ADDR] = &tail<&CPU::opADDR>;       handlers[ADDI] = &tail<&CPU::opADDI>;
+                handlers[SUBR] = &tail<&CPU::opSUBR>;       handlers[SUBI] = &tail<&CPU::opSUBI>;
+                handlers[CMP] = &tail<&CPU::opCMP>;         handlers[JMP] = &tail<&CPU::opJMP>;
+                handlers[JZ] = &tail<&CPU::opJZ>;           handlers[JNZ] = &tail<&CPU::opJNZ>;
+                handlers[HLT] = &tail<&CPU::opHLT>;         handlers[NOP] = &tail<&CPU::opNOP>;
+                handlers[LOADR] = &tail<&CPU::opLOADR>;     handlers[LOADI] = &tail<&CPU::opLOADI>;
+                handlers[STORER] = &tail<&CPU::opSTORER>;   handlers[STOREI] = &tail<&CPU::opSTOREI>;
+                handlers[ANDR] = &tail<&CPU::opANDR>;       handlers[ANDI] = &tail<&CPU::opANDI>;
+                handlers[ORR] = &tail<&CPU::opORR>;         handlers[ORI] = &tail<&CPU::opORI>;
+                handlers[LSR] = &tail<&CPU::opLSR>;         handlers[LSL] = &tail<&CPU::opLSL>;
+                handlers[CAS] = &tail<&CPU::opCAS>;         handlers[FADD] = &tail<&CPU::opFADD>;
+                handlers[COREID] = &tail<&CPU::opCOREID>;
+                handlers[SETTRAP] = &tail<&CPU::opSETTRAP>; handlers[GETTRAP] = &tail<&CPU::opGETTRAP>;
+                handlers[FUSED_CMP_JZ] = &tail<&CPU::opCMPJZ>;          handlers[FUSED_CMP_JNZ] = &tail<&CPU::opCMPJNZ>;
+                handlers[FUSED_ADDI_ADDI] = &tail<&CPU::opADDIADDI>;    handlers[FUSED_LOADR_ANDI] = &tail<&CPU::opLOADRANDI>;
+            }
+        };
+
+        static const Table table;
+        return table.handlers;
+    }
+
+    void runThreaded()
+    {
+        const TailHandler* handlers = tailHandlers();
+
+        while (!HALTED && remaining)
+        {
+            remaining--;
+            const DecodedInstr& instr = fetch();
+            handlers[instr.operation](*this, instr, TAIL_CHAIN_LENGTH);
+        }
+    }
+#endif
+
+#ifdef CPU_HAS_JIT
+    // Translated code runs until it meets something it leaves to the interpreter, like a store
+    // into translated code or a load across the ROM/RAM boundary, which is then stepped here.
+    // Only the interpreted instructions reach the trace policy.
+    void runJIT()
+    {
+        while (!HALTED)
+        {
+            if(jit->run(registers, PC, ZF) == JIT_EXIT_HALT)
+            {
+                HALTED = true;
+                break;
+            }
+
+            step();
+        }
+    }
+#endif
+
+    // Drop the decoded instructions around a written word
+    void drop(uint32_t adress)
+    {
+        codeEpoch++;                                    // The word may be in the body of an analysed loop
+
+        // A word write can touch the two aligned instructions around it, and a pair fused from the word before
+        for(uint32_t word : { (adress & ~3u) - 4, adress & ~3u, (adress + 3) & ~3u })
+        {
+            DecodedInstr* entries = findDecodedPage(word >> DECODE_PAGE_BITS);
+            if(entries) entries[(word >> 2) & (DECODE_PAGE_ENTRIES - 1)].handler = nullptr;
+        }
+    }
+
+    // Drop the code other cores wrote over since the last time
+    void sync()
+    {
+        if(!stale.load(std::memory_order_acquire)) return;
+
+        std::vector<uint32_t> written;
+        {
+            std::lock_guard<std::mutex> guard(pendingLock);
+            written.swap(pending);
+            stale.store(false, std::memory_order_relaxed);
+        }
+
+        for(uint32_t adress : written)
+            drop(adress);
     }
 
 public:
-    CPU(MEMC* memory)
+    // core_id tells the CPU apart from the other cores over the same MEMC. Over a shared MEMC
+    // ENGINE_JIT runs on the threaded core, translated stores don't keep words whole.
+    CPU(MEMC* memory, Engine engine = ENGINE_HANDLER, uint32_t core_id = 0)
     {
         this->memory = memory;      // Add memory controler
-        PC = 0x0;                   // Set the program counter to adress 0 
-        HALTED = 0;                 // Set the halted flag to false 
+        this->engine = engine;      // Pick the interpreter core
+        coreID = core_id;
+        PC = 0x0;                   // Set the program counter to adress 0
+        remaining = UNLIMITED_BUDGET;
+        unlimited = true;
+        fusion = std::is_same<TracePolicy, NoTrace>::value;    // Other policies see every instruction on its own
+        fastForward = fusion;
+        HALTED = 0;                 // Set the halted flag to false
         ZF = 0;                     // Set the zero flag to false
+        trapCause = FAULT_NONE;
+        trapPC = 0;
+        trapHandler = 0;            // Traps halt until the guest sets a handler
+        TRAPPED = 0;
+
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            registers[i] = 0;       // Clear the registers
+
+        memory->attach(this);       // Get told about writes to cached code
+
+#ifdef CPU_HAS_JIT
+        if(engine == ENGINE_JIT && memory->isShared())
+            this->engine = ENGINE_THREADED;
+        else if(engine == ENGINE_JIT)
+            jit.reset(new JIT(memory));
+#else
+        if(engine == ENGINE_JIT)
+            this->engine = ENGINE_THREADED;
+#endif
     }
 
-    void run()
+    CPU(const CPU&) = delete;
+    CPU& operator=(const CPU&) = delete;
+
+    ~CPU()
+    {
+        memory->detach(this);
+    }
+
+    void invalidate(uint32_t adress) override
     {
-        while (!HALTED)                     // Execute the instruction until halt
-        {   
-            execute(memory->read(PC));      // Execute the instruction at the specified memory adress
+        if(memory->isShared() && RunningCPU != this)
+        {
+            std::lock_guard<std::mutex> guard(pendingLock);     // Another core wrote, this one may be running
+            pending.push_back(adress);
+            stale.store(true, std::memory_order_release);
+            return;
+        }
+
+        drop(adress);
+    }
 
-            PrintState();                   // Debug CPU values
+    // Execute a single instruction
+    void step()
+    {
+        uint32_t instructionPC = PC;
+        const DecodedInstr* instr = &fetch();
+        if(isFused(*instr))
+        {
+            uncached = decode(instr->instruction);      // Just the first instruction of the pair
+            instr = &uncached;
         }
+
+        (this->*instr->handler)(*instr);
+
+        trace.step(instructionPC, instr->instruction, registers, ZF, PC);
+    }
+
+    // Start over from adress 0, the decoded instructions stay cached
+    void reset()
+    {
+        PC = 0x0;
+        HALTED = 0;
+        ZF = 0;
+        trapCause = FAULT_NONE;
+        trapPC = 0;
+        trapHandler = 0;
+        TRAPPED = 0;
+
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            registers[i] = 0;
+    }
+
+    CPUState getState() const
+    {
+        CPUState state;
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            state.registers[i] = registers[i];
+        state.PC = PC;
+        state.HALTED = HALTED;
+        state.ZF = ZF;
+        state.trapCause = trapCause;
+        state.trapPC = trapPC;
+        state.trapHandler = trapHandler;
+        state.TRAPPED = TRAPPED;
+        return state;
+    }
+
+    const TracePolicy& getTrace() const
+    {
+        return trace;
+    }
+
+    void setState(const CPUState& state)
+    {
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            registers[i] = state.registers[i];
+        PC = state.PC;
+        HALTED = state.HALTED;
+        ZF = state.ZF;
+        trapCause = state.trapCause;
+        trapPC = state.trapPC;
+        trapHandler = state.trapHandler;
+        TRAPPED = state.TRAPPED;
+    }
+
+    void run()
+    {
+        remaining = UNLIMITED_BUDGET;
+        unlimited = true;
+        RunningCPU = this;
+        sync();
+
+        if(engine == ENGINE_THREADED)
+            runThreaded();
+#ifdef CPU_HAS_JIT
+        else if(engine == ENGINE_JIT)
+            runJIT();
+#endif
+        else
+            runHandler();
+
+        trace.halt(PC, registers, ZF);
+    }
+
+    // Run until HLT, a trap without a handler or until budget instructions have been dispatched, and
+    // return how many were. HALTED stays false when the budget ran out first. Translated code doesn't count instructions,
+    // so ENGINE_JIT runs a budget on the threaded core.
+    uint64_t run(uint64_t budget)
+    {
+        remaining = budget;
+        unlimited = budget == UNLIMITED_BUDGET;
+        RunningCPU = this;
+        sync();
+
+        if(engine == ENGINE_HANDLER)
+            runHandler();
+        else
+            runThreaded();
+
+        if(HALTED) trace.halt(PC, registers, ZF);
+        return budget - remaining;
+    }
+
+    // Budget left by the last run(budget), a trapping instruction counts
+    uint64_t getRemaining() const
+    {
+        return remaining;
+    }
+
+    // Fuse common instruction pairs or not, only CPUs without tracing can. Drops the decoded instructions.
+    void setFusion(bool enabled)
+    {
+        fusion = enabled && std::is_same<TracePolicy, NoTrace>::value;
+        decoded.clear();
+        decodedPage = nullptr;
+        decodedPageNumber = ~0u;
+    }
+
+    // Instructions that ran as the second half of a fused pair, each one a dispatch saved
+    uint64_t getFused() const
+    {
+        return fused;
+    }
+
+    // Fast forward counted and copy loops or not, only CPUs that fuse can. Drops the decoded instructions.
+    void setFastForward(bool enabled)
+    {
+        fastForward = enabled && std::is_same<TracePolicy, NoTrace>::value;
+        loops.clear();
+        setFusion(fusion);
+    }
+
+    // Instructions of loop iterations that were fast forwarded instead of dispatched
+    uint64_t getForwarded() const
+    {
+        return forwarded;
     }
-};
\ No newline at end of file
+};
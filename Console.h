@@ -0,0 +1,137 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "MemoryControler.h"
+
+const uint32_t CONSOLE_BASE = 0xFF10;       // In the I/O hole, right after the DMA controller
+const uint32_t CONSOLE_SIZE = 0x8;
+
+// Registers, offsets from CONSOLE_BASE
+const uint32_t CONSOLE_DATA = 0x0;          // Store a word to print its low byte
+const uint32_t CONSOLE_STATUS = 0x4;        // Read the status bits, store anything to clear CONSOLE_DROPPED
+
+// Status bits
+const uint32_t CONSOLE_FULL = 0x1;          // The ring has no room, a byte printed now is dropped
+const uint32_t CONSOLE_DROPPED = 0x2;       // A byte was dropped since the flag was last cleared
+
+const uint64_t CONSOLE_RING_BYTES = 1 << 16;                                // Power of two
+const std::chrono::microseconds CONSOLE_DRAIN_INTERVAL(200);                // Sleep of the drain thread when the ring is empty
+
+// Output port for guests. Bytes stored to the data register go into a single producer, single
+// consumer ring; a host thread started with the first byte writes them out in batches, so stores
+// never wait for the stream. When the ring is full the byte is dropped and the status says so,
+// guests that must not lose output poll CONSOLE_FULL first. The drain thread runs on its own
+// time, so how often a guest finds the ring full varies from run to run.
+class Console : public Device
+{
+private:
+    std::ostream& out;
+    std::unique_ptr<char[]> ring;
+    std::atomic<uint64_t> head{ 0 };        // Bytes pushed, only the guest side writes it
+    std::atomic<uint64_t> tail{ 0 };        // Bytes written out, only the drain thread writes it
+    std::atomic<bool> stopping{ false };
+    std::thread drainer;
+
+    bool dropped = false;
+    uint64_t droppedBytes = 0;
+
+    bool full() const
+    {
+        return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) == CONSOLE_RING_BYTES;
+    }
+
+    void push(char byte)
+    {
+        if(full())
+        {
+            dropped = true;
+            droppedBytes++;
+            return;
+        }
+
+        uint64_t position = head.load(std::memory_order_relaxed);
+        ring[position & (CONSOLE_RING_BYTES - 1)] = byte;
+        head.store(position + 1, std::memory_order_release);
+
+        if(!drainer.joinable())
+            drainer = std::thread(&Console::drain, this);
+    }
+
+    // Writes whatever is in the ring, up to its end at a time, and flushes once it runs empty
+    void drain()
+    {
+        uint64_t position = tail.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            if(end == position)
+            {
+                if(stopping.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == position) break;
+
+                out.flush();
+                std::this_thread::sleep_for(CONSOLE_DRAIN_INTERVAL);
+                continue;
+            }
+
+            uint64_t start = position & (CONSOLE_RING_BYTES - 1);
+            uint64_t count = std::min(end - position, CONSOLE_RING_BYTES - start);
+            out.write(ring.get() + start, count);
+
+            position += count;
+            tail.store(position, std::memory_order_release);
+        }
+        out.flush();
+    }
+
+public:
+    Console(std::ostream& out = std::cout) : out(out), ring(new char[CONSOLE_RING_BYTES]) {}
+
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    // Everything printed is written out before the console goes
+    ~Console()
+    {
+        if(drainer.joinable())
+        {
+            stopping.store(true, std::memory_order_release);
+            drainer.join();
+        }
+    }
+
+    uint32_t read(uint32_t offset) override
+    {
+        if(offset != CONSOLE_STATUS) return 0;
+        return (full() ? CONSOLE_FULL : 0) | (dropped ? CONSOLE_DROPPED : 0);
+    }
+
+    void write(uint32_t offset, uint32_t value) override
+    {
+        if(offset == CONSOLE_DATA) push(char(value & 0xFF));
+        else dropped = false;
+    }
+
+    // Wait until the drain thread has written out every byte printed so far
+    void flush()
+    {
+        while(tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed))
+            std::this_thread::sleep_for(CONSOLE_DRAIN_INTERVAL);
+    }
+
+    uint64_t getPrinted() const
+    {
+        return head.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getDropped() const
+    {
+        return droppedBytes;
+    }
+};
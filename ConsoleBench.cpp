@@ -0,0 +1,129 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+#include "Assembler.h"
+#include "CPU.h"
+#include "Console.h"
+
+// A guest printing bytes in a loop, to the console and to a port that writes every byte out on
+// the store, like the emulator's own tracing does. Output goes to console.out.
+
+const int DEFAULT_BYTES = 60000;            // Fits the 16 bit immediate of the loop count
+
+// Writes each byte to the stream before the store returns
+class BlockingPort : public Device
+{
+private:
+    std::ostream& out;
+
+public:
+    BlockingPort(std::ostream& out) : out(out) {}
+
+    uint32_t read(uint32_t /*offset*/) override
+    {
+        return 0;
+    }
+
+    void write(uint32_t offset, uint32_t value) override
+    {
+        if(offset == CONSOLE_DATA) out.put(char(value & 0xFF)).flush();
+    }
+
+    void flush()
+    {
+        out.flush();
+    }
+};
+
+// Prints bytes digits and letters, waiting while CONSOLE_FULL is set when poll is true
+std::vector<uint32_t> Printer(uint32_t bytes, bool poll)
+{
+    std::vector<uint32_t> words =
+    {
+        EncInstr(MVI, 0, 0, 0),                                 // 0   Printed
+        EncInstr(MVI, 1, 0, bytes),                             // 1   To print
+        EncInstr(MVI, 3, 0, 0),                                 // 2   Zero to compare with
+    };
+
+    if(poll)
+    {
+        words.push_back(EncInstr(LOADI, 2, 0, CONSOLE_BASE + CONSOLE_STATUS));     // 3   0x0C
+        words.push_back(EncInstr(ANDI, 2, 0, CONSOLE_FULL));                        // 4
+        words.push_back(EncInstr(CMP, 2, 3));                                       // 5
+        words.push_back(EncInstr(JNZ, 0, 0, 0x0C));                                 // 6   Ring is full
+    }
+
+    words.push_back(EncInstr(MVR, 2, 0));                                           // Byte from the count
+    words.push_back(EncInstr(ANDI, 2, 0, 0x3F));
+    words.push_back(EncInstr(ADDI, 2, 0, '0'));
+    words.push_back(EncInstr(STOREI, 2, 0, CONSOLE_BASE + CONSOLE_DATA));
+    words.push_back(EncInstr(ADDI, 0, 0, 1));
+    words.push_back(EncInstr(CMP, 0, 1));
+    words.push_back(EncInstr(JNZ, 0, 0, 0x0C));
+    words.push_back(EncInstr(HLT, 0, 0));
+
+    return words;
+}
+
+// Runs the printer with device at CONSOLE_BASE, time to the HLT and time until the output is out
+template<typename Output>
+void Time(ROM* rom, Engine engine, Output& device, uint32_t bytes)
+{
+    RAM ram(MEMORY_SIZE_BYTES);
+    MEMC memory(rom, &ram);
+    memory.mapDevice(CONSOLE_BASE, CONSOLE_SIZE, &device);
+    CPU<NoTrace> cpu(&memory, engine);
+
+    auto start = std::chrono::steady_clock::now();
+    cpu.run(UNLIMITED_BUDGET);
+    auto halted = std::chrono::steady_clock::now();
+    device.flush();
+    auto written = std::chrono::steady_clock::now();
+
+    double guest = std::chrono::duration<double>(halted - start).count();
+    double total = std::chrono::duration<double>(written - start).count();
+    std::cout << guest * 1e9 / bytes << " ns per byte to the HLT, "
+              << total * 1e9 / bytes << " ns per byte until written\n";
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t bytes = argc > 1 ? std::atoi(argv[1]) : DEFAULT_BYTES;
+
+    try
+    {
+        std::ofstream out("console.out", std::ios::binary);
+
+        for(bool poll : { false, true })
+        {
+            std::vector<uint8_t> image = ImageBytes(Printer(bytes, poll), STORAGE_SIZE_BYTES);
+            ROM rom(image.data(), image.size());
+
+            std::cout << (poll ? "Polling CONSOLE_FULL" : "Not polling") << ":\n";
+            for(Engine engine : { ENGINE_HANDLER, ENGINE_JIT })
+            {
+                const char* engine_name = engine == ENGINE_JIT ? "jit" : "handler";
+
+                BlockingPort port(out);
+                std::cout << "  " << engine_name << " blocking port: ";
+                Time(&rom, engine, port, bytes);
+
+                Console console(out);
+                std::cout << "  " << engine_name << " console      : ";
+                Time(&rom, engine, console, bytes);
+                std::cout << "    " << console.getPrinted() << " printed, " << console.getDropped() << " dropped\n";
+            }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+
+#include "MemoryControler.h"
+
+const uint32_t DMA_BASE = 0xFF00;           // In the I/O hole above RAM, in reach of LOADI/STOREI
+const uint32_t DMA_SIZE = 0x10;
+
+// Registers, offsets from DMA_BASE
+const uint32_t DMA_SOURCE = 0x0;            // First byte to copy, in ROM or RAM
+const uint32_t DMA_DESTINATION = 0x4;       // Where it goes, in RAM
+const uint32_t DMA_LENGTH = 0x8;            // Bytes, a multiple of 4
+const uint32_t DMA_CONTROL = 0xC;           // Write DMA_START to start a transfer, read the status bits
+
+// Control and status bits
+const uint32_t DMA_START = 0x1;
+const uint32_t DMA_BUSY = 0x1;              // A transfer is running
+const uint32_t DMA_DONE = 0x2;              // The last transfer finished
+const uint32_t DMA_ERROR = 0x4;             // The last transfer was refused, nothing was copied
+
+// Block transfer controller. A started transfer is one MEMC::copy, so it moves whole pages with
+// memmove where it can and still drops cached code it writes over. Guests poll the status until
+// BUSY clears; transfers finish before the store that starts them returns, so BUSY never shows
+// and runs stay the same on every engine.
+class DMA : public Device
+{
+private:
+    MEMC* memory;
+    uint32_t source = 0;
+    uint32_t destination = 0;
+    uint32_t length = 0;
+    uint32_t status = 0;
+    uint64_t transfers = 0;
+    uint64_t transferred = 0;
+
+    // The same checks a copy loop would run into, ahead of the first byte: loads from ROM or RAM,
+    // stores into RAM. Overlapping ranges are refused too.
+    bool allowed() const
+    {
+        uint64_t source_end = uint64_t(source) + length;
+        uint64_t destination_end = uint64_t(destination) + length;
+
+        return length % 4 == 0
+        && source_end <= memory->RAM_PARTITION_END
+        && destination >= memory->ROM_PARTITION_END && destination_end <= memory->RAM_PARTITION_END
+        && (destination_end <= source || source_end <= destination);
+    }
+
+    void start()
+    {
+        if(!allowed())
+        {
+            status = DMA_DONE | DMA_ERROR;
+            return;
+        }
+
+        if(memory->copy(destination, source, length / 4))
+        {
+            status = DMA_DONE | DMA_ERROR;
+            return;
+        }
+        transfers++;
+        transferred += length;
+        status = DMA_DONE;
+    }
+
+public:
+    DMA(MEMC* memory) : memory(memory) {}
+
+    uint32_t read(uint32_t offset) override
+    {
+        switch (offset)
+        {
+        case DMA_SOURCE:        return source;
+        case DMA_DESTINATION:   return destination;
+        case DMA_LENGTH:        return length;
+        default:                return status;
+        }
+    }
+
+    void write(uint32_t offset, uint32_t value) override
+    {
+        switch (offset)
+        {
+        case DMA_SOURCE:        source = value;         break;
+        case DMA_DESTINATION:   destination = value;    break;
+        case DMA_LENGTH:        length = value;         break;
+        default:
+            if(value & DMA_START) start();
+            break;
+        }
+    }
+
+    uint64_t getTransfers() const
+    {
+        return transfers;
+    }
+
+    uint64_t getTransferred() const
+    {
+        return transferred;
+    }
+};
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#include "CPU.h"
+
+const int DEFAULT_REPETITIONS = 200000;
+
+// Tracing policy that only counts instructions, so the benchmark can report MIPS
+class CountTrace
+{
+public:
+    uint64_t executed = 0;
+
+    void step(uint32_t /*PC*/, uint32_t /*instruction*/, const uint32_t* /*registers*/, bool /*ZF*/, uint32_t /*nextPC*/)
+    {
+        executed++;
+    }
+
+    void access(uint32_t /*adress*/, bool /*store*/, bool /*rom*/) {}
+
+    void halt(uint32_t /*PC*/, const uint32_t* /*registers*/, bool /*ZF*/) {}
+};
+
+// Runs the ROM image from reset the given number of times and returns the final state
+CPUState Bench(MEMC* memory, Engine engine, const char* name, int repetitions, uint64_t instructions)
+{
+    CPU<NoTrace> cpu(memory, engine);
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < repetitions; i++)
+    {
+        cpu.reset();
+        cpu.run();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << instructions << " instructions in " << seconds << " s -> "
+              << (instructions / seconds) / 1e6 << " MIPS\n";
+
+    return cpu.getState();
+}
+
+bool SameState(const CPUState& a, const CPUState& b)
+{
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        if(a.registers[i] != b.registers[i]) return false;
+
+    return a.PC == b.PC && a.HALTED == b.HALTED && a.ZF == b.ZF;
+}
+
+int main(int argc, char* argv[])
+{
+    int repetitions = argc > 1 ? std::atoi(argv[1]) : DEFAULT_REPETITIONS;
+
+    try
+    {
+        ROM rom(ROM_FILE_PATH);
+        RAM ram(MEMORY_SIZE_BYTES);
+        MEMC memory_controler(&rom, &ram);
+
+        // Count the instructions of one run separately so counting doesn't slow down the timed loops
+        CPU<CountTrace> counter(&memory_controler);
+        counter.run();
+        uint64_t instructions = counter.getTrace().executed * repetitions;
+
+        CPUState handler = Bench(&memory_controler, ENGINE_HANDLER, "handler ", repetitions, instructions);
+        CPUState threaded = Bench(&memory_controler, ENGINE_THREADED, "threaded", repetitions, instructions);
+        CPUState jit = Bench(&memory_controler, ENGINE_JIT, "jit     ", repetitions, instructions);
+
+        if(!SameState(handler, threaded) || !SameState(handler, jit))
+        {
+            std::cerr << "Engines disagree on the final state\n";
+            return 1;
+        }
+
+        // Dispatches the fused instruction pairs and the fast forwarded loops save on one run of the image
+        CPU<NoTrace> fusing(&memory_controler);
+        uint64_t executed = fusing.run(UNLIMITED_BUDGET);
+        std::cout << "fusion  : " << fusing.getFused() << " of " << executed << " dispatches removed\n";
+        std::cout << "forward : " << fusing.getForwarded() << " of " << executed << " instructions skipped\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #define MVR     0x00   // set a regsiter to another
 #define MVI     0x01   // set a register to an immediate
 #define ADDR    0x02   // add registerB to the registerB
@@ -19,4 +21,11 @@
 #define ORR     0x12   // bitwise OR operation regiserA OR= regiseterB  
 #define ORI     0X13   // bitwise OR operation regiserA OR= immediate
 #define LSR     0x14   // bitwise Shift Bit to Right registerA >>= immediate  
-#define LSL     0x15   // bitwise Shift Bit to Right registerA <<= immediate
\ No newline at end of file
+#define LSL     0x15   // bitwise Shift Bit to Right registerA <<= immediate
+#define CAS     0x16   // compare and swap, store registerB at immediate adress if it holds registerA (ZF true), else load it into registerA (ZF false)
+#define FADD    0x17   // fetch and add, add registerA to memory at registerB adress and set registerA to the old value
+#define COREID  0x18   // set registerA to the ID of the core running it
+#define SETTRAP 0x19   // set the trap handler adress to the immediate, 0 makes traps halt the CPU
+#define GETTRAP 0x1A   // set registerA to the cause of the last trap and registerB to the PC it happened at, then clear the cause
+
+const int REGISTER_COUNT = 4;    // general purpose registers R0 - R3
@@ -0,0 +1,530 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+
+#include "MemoryControler.h"
+#include "Instructions.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CPU_HAS_JIT 1
+#include <sys/mman.h>
+#endif
+
+const int JIT_BUFFER_BYTES = 1024 * 1024 * 4;   // 4 MB of host code before everything is flushed
+const int JIT_BLOCK_INSTRUCTIONS = 64;          // Longest translated basic block
+const int JIT_BLOCK_BYTES = 1024 * 8;           // Room a block may take in the buffer (worst case and stubs)
+const int JIT_PAGE_BITS = 8;                    // 256 byte RAM pages for the translated code map
+static_assert(JIT_PAGE_BITS == PAGE_BITS, "Translated stores mark MEMC dirty pages with the same page numbers");
+
+// Why the translated code gave control back
+enum JITExit
+{
+    JIT_EXIT_BRANCH,        // Reached a block that isn't translated yet, keep going from PC
+    JIT_EXIT_INTERPRET,     // The instruction at PC has to go through the interpreter
+    JIT_EXIT_HALT           // HLT at PC
+};
+
+// Guest state while translated code runs, the layout is used by the generated code
+struct JITState
+{
+    uint32_t registers[REGISTER_COUNT];
+    uint32_t PC;
+    uint32_t ZF;
+    uint32_t exit;
+    uint32_t unused;
+    const uint8_t* rom;                     // Host adress of ROM adress 0
+    uint8_t* ram;                           // Host adress of RAM adress 0
+    const uint8_t* codePages;               // One byte per RAM page, set when the page holds translated code
+    uint8_t* dirtyPages;                    // One byte per RAM page, set by every store (MEMC::dirtyPages)
+    const uint8_t* entry;                   // Block to start at
+};
+
+#ifdef CPU_HAS_JIT
+
+// Translates guest basic blocks into x86-64 code. A block ends at JMP, JZ, JNZ or HLT.
+// Inside translated code the guest registers live in r8d-r11d and ZF in ecx, blocks jump
+// straight to each other once both are translated, and loads/stores that don't fit
+// completely in ROM or RAM (or store into translated code) exit to the interpreter.
+// Stores that stay in translated code set the MEMC dirty byte of the pages they write.
+// A sparse RAM has no host block to index, so code in it is interpreted and every
+// RAM access from translated code exits.
+class JIT : public CodeCache
+{
+private:
+    // Host registers
+    enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7, R8 = 8, R12 = 12, R13 = 13 };
+
+    MEMC* memory;
+    uint32_t romSize;
+    uint32_t ramStart;
+    uint32_t ramSize;
+
+    uint8_t* buffer;                        // Executable host code
+    uint8_t* code;                          // Where the next block is emitted
+    uint8_t* exitCode;                      // Stores the registers back into JITState and returns
+    void (*enter)(JITState*);               // Loads the registers from JITState and jumps to entry
+
+    std::unordered_map<uint32_t, uint8_t*> blocks;                  // Guest PC -> translated block
+    std::unordered_map<uint32_t, std::vector<uint8_t*>> links;      // Guest PC -> exit stubs waiting for that block
+    std::vector<uint8_t> codePages;
+
+    JITState state;
+
+    // EMITTER
+    void byte(uint8_t value)
+    {
+        *code++ = value;
+    }
+
+    void dword(uint32_t value)
+    {
+        std::memcpy(code, &value, 4);
+        code += 4;
+    }
+
+    void rex(bool wide, int reg, int rm, int index = 0)
+    {
+        uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+        if(prefix != 0x40) byte(prefix);
+    }
+
+    void modrm(int mod, int reg, int rm)
+    {
+        byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    int guest(uint8_t reg)                  // Host register of a guest register
+    {
+        return R8 + reg;
+    }
+
+    void aluRR(uint8_t opcode, int dst, int src)        // op dst32, src32
+    {
+        rex(false, src, dst);
+        byte(opcode);
+        modrm(3, src, dst);
+    }
+
+    void aluRI(int extension, int dst, uint32_t imm)    // op dst32, imm32
+    {
+        rex(false, 0, dst);
+        byte(0x81);
+        modrm(3, extension, dst);
+        dword(imm);
+    }
+
+    void movRI(int dst, uint32_t imm)                   // mov dst32, imm32
+    {
+        rex(false, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+
+    void shiftRI(int extension, int dst, uint8_t count) // shl/shr dst32, imm8
+    {
+        if(count == 0) return;
+        rex(false, 0, dst);
+        byte(0xC1);
+        modrm(3, extension, dst);
+        byte(count);
+    }
+
+    void stateOp(bool wide, uint8_t opcode, int reg, size_t offset)   // op reg, [rdi + offset]
+    {
+        rex(wide, reg, RDI);
+        byte(opcode);
+        modrm(1, reg, RDI);
+        byte(uint8_t(offset));
+    }
+
+    void indexedOp(uint8_t opcode, int reg, int base)   // op reg32, [base + rax]
+    {
+        rex(false, reg, base);
+        byte(opcode);
+        modrm(0, reg, 4);
+        byte((RAX << 3) | base);
+    }
+
+    void displacedOp(uint8_t opcode, int reg, int base, uint32_t displacement)   // op reg32, [base + disp32]
+    {
+        rex(false, reg, base);
+        byte(opcode);
+        modrm(2, reg, base);
+        dword(displacement);
+    }
+
+    uint8_t* jump(uint8_t condition = 0)                // jmp/jcc rel32, returns the rel32 to patch
+    {
+        if(condition) { byte(0x0F); byte(condition); }
+        else byte(0xE9);
+        code += 4;
+        return code - 4;
+    }
+
+    void patch(uint8_t* rel, const uint8_t* target)
+    {
+        int32_t offset = int32_t(target - (rel + 4));
+        std::memcpy(rel, &offset, 4);
+    }
+
+    // Leave translated code with the next PC and a reason
+    void exitTo(uint32_t PC, JITExit reason)
+    {
+        movRI(RAX, PC);
+        byte(0xC7); modrm(1, 0, RDI); byte(offsetof(JITState, exit)); dword(reason);
+        patch(jump(), exitCode);
+    }
+
+    // Continue at a guest PC, straight into its block when it's translated or through a stub that gets
+    // patched into a jump once it is
+    void branchTo(uint32_t PC)
+    {
+        auto block = blocks.find(PC);
+        if(block != blocks.end())
+        {
+            patch(jump(), block->second);
+            return;
+        }
+
+        links[PC].push_back(code);          // The first 5 bytes (mov eax, PC) become the jump later
+        exitTo(PC, JIT_EXIT_BRANCH);
+    }
+
+    void emitStubs()
+    {
+        // enter(JITState* state)
+        enter = (void (*)(JITState*))code;
+        byte(0x53);                                                 // push rbx
+        byte(0x41); byte(0x54);                                     // push r12
+        byte(0x41); byte(0x55);                                     // push r13
+        stateOp(true, 0x8B, RBX, offsetof(JITState, codePages));   // mov rbx, [rdi + codePages]
+        stateOp(true, 0x8B, R13, offsetof(JITState, dirtyPages));  // mov r13, [rdi + dirtyPages]
+        stateOp(true, 0x8B, RSI, offsetof(JITState, rom));         // mov rsi, [rdi + rom]
+        stateOp(true, 0x8B, RDX, offsetof(JITState, ram));         // mov rdx, [rdi + ram]
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            stateOp(false, 0x8B, guest(i), i * 4);                  // mov r8d + i, [rdi + registers + i]
+        stateOp(false, 0x8B, RCX, offsetof(JITState, ZF));         // mov ecx, [rdi + ZF]
+        byte(0xFF); modrm(1, 4, RDI); byte(offsetof(JITState, entry));  // jmp [rdi + entry]
+
+        // Every block leaves through here with the next PC in eax
+        exitCode = code;
+        stateOp(false, 0x89, RAX, offsetof(JITState, PC));         // mov [rdi + PC], eax
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            stateOp(false, 0x89, guest(i), i * 4);                  // mov [rdi + registers + i], r8d + i
+        stateOp(false, 0x89, RCX, offsetof(JITState, ZF));         // mov [rdi + ZF], ecx
+        byte(0x41); byte(0x5D);                                     // pop r13
+        byte(0x41); byte(0x5C);                                     // pop r12
+        byte(0x5B);                                                 // pop rbx
+        byte(0xC3);                                                 // ret
+    }
+
+    void flush()
+    {
+        code = buffer;
+        blocks.clear();
+        links.clear();
+        std::fill(codePages.begin(), codePages.end(), 0);
+        emitStubs();
+    }
+
+    // Mark the RAM pages under a block, starting 3 bytes early so a word store that only
+    // overlaps the first instruction is still caught by the page of its adress
+    void markCode(uint32_t start, uint32_t end)
+    {
+        for(uint32_t adress = start; adress < end; adress += 4)
+            memory->markCode(adress);               // Interpreted stores into the block have to reach invalidate()
+
+        if(end <= ramStart) return;
+
+        uint32_t first = start < ramStart + 3 ? 0 : start - ramStart - 3;
+        uint32_t last = end - ramStart - 1;
+        for(uint32_t page = first >> JIT_PAGE_BITS; page <= (last >> JIT_PAGE_BITS) && page < codePages.size(); page++)
+            codePages[page] = 1;
+    }
+
+    bool inROM(uint32_t adress)
+    {
+        return romSize >= 4 && adress <= romSize - 4;
+    }
+
+    bool inRAM(uint32_t adress)
+    {
+        return ramSize >= 4 && adress >= ramStart && adress - ramStart <= ramSize - 4;
+    }
+
+    // Translate the block at PC, nullptr when its first instruction can't be translated
+    uint8_t* translate(uint32_t PC)
+    {
+        if(code + JIT_BLOCK_BYTES > buffer + JIT_BUFFER_BYTES)
+            flush();
+
+        uint8_t* block = code;
+        std::vector<std::pair<uint8_t*, uint32_t>> sideExits;     // Jumps to the interpreter exit of an instruction
+        uint32_t pc = PC;
+        bool ended = false;
+        bool interpret = false;                 // Stopped in front of an instruction only the interpreter runs
+
+        for(int count = 0; count < JIT_BLOCK_INSTRUCTIONS && !ended; count++)
+        {
+            if(pc >= ramStart && !inRAM(pc))
+            {
+                interpret = true;               // Not in host memory the block could be checked against
+                break;
+            }
+
+            uint32_t instruction;
+            if(memory->load(pc, instruction))
+            {
+                interpret = true;               // Let the interpreter trap
+                break;
+            }
+
+            uint8_t operation = (instruction >> 24) & 0xFF;
+            uint8_t registerA = (instruction >> 20) & 0xF;
+            uint8_t registerB = (instruction >> 16) & 0xF;
+            uint16_t immediate = instruction & 0xFFFF;
+
+            if(operation > LSL || registerA >= REGISTER_COUNT || registerB >= REGISTER_COUNT)
+            {
+                interpret = true;               // Illegal instruction or atomic, the interpreter runs it
+                break;
+            }
+
+            int A = guest(registerA);
+            int B = guest(registerB);
+
+            switch (operation)
+            {
+            case MVR:   aluRR(0x89, A, B);          break;
+            case ADDR:  aluRR(0x01, A, B);          break;
+            case SUBR:  aluRR(0x29, A, B);          break;
+            case ANDR:  aluRR(0x21, A, B);          break;
+            case ORR:   aluRR(0x09, A, B);          break;
+            case MVI:   movRI(A, immediate);        break;
+            case ADDI:  aluRI(0, A, immediate);     break;
+            case ORI:   aluRI(1, A, immediate);     break;
+            case ANDI:  aluRI(4, A, immediate);     break;
+            case SUBI:  aluRI(5, A, immediate);     break;
+            case LSL:   shiftRI(4, A, immediate & 31);  break;
+            case LSR:   shiftRI(5, A, immediate & 31);  break;
+            case NOP:                               break;
+            case CMP:
+                byte(0x31); byte(0xC9);             // xor ecx, ecx
+                aluRR(0x39, A, B);                  // cmp A, B
+                byte(0x0F); byte(0x94); byte(0xC1); // sete cl
+                break;
+            case LOADR:
+            {
+                aluRR(0x89, RAX, B);                // mov eax, B
+                aluRI(7, RAX, romSize - 4);         // cmp eax, ROM_END - 4
+                uint8_t* notROM = jump(0x87);       // ja notROM
+                indexedOp(0x8B, A, RSI);            // mov A, [rsi + rax]
+                uint8_t* done = jump();
+                patch(notROM, code);
+                if(ramSize < 4)
+                    sideExits.push_back({ jump(), pc });    // No RAM to index
+                else
+                {
+                    aluRI(5, RAX, ramStart);        // sub eax, RAM start
+                    aluRI(7, RAX, ramSize - 4);     // cmp eax, RAM size - 4
+                    sideExits.push_back({ jump(0x87), pc });
+                    indexedOp(0x8B, A, RDX);        // mov A, [rdx + rax]
+                }
+                patch(done, code);
+                break;
+            }
+            case STORER:
+                if(ramSize < 4)
+                {
+                    exitTo(pc, JIT_EXIT_INTERPRET);
+                    ended = true;
+                    break;
+                }
+                aluRR(0x89, RAX, B);                // mov eax, B
+                aluRI(5, RAX, ramStart);            // sub eax, RAM start
+                aluRI(7, RAX, ramSize - 4);         // cmp eax, RAM size - 4
+                sideExits.push_back({ jump(0x87), pc });
+                byte(0x41); byte(0x89); modrm(3, RAX, R12);             // mov r12d, eax
+                byte(0x41); byte(0xC1); modrm(3, 5, R12); byte(JIT_PAGE_BITS);  // shr r12d, page bits
+                byte(0x42); byte(0x80); modrm(0, 7, 4); byte(((R12 & 7) << 3) | RBX); byte(0);  // cmp byte [rbx + r12], 0
+                sideExits.push_back({ jump(0x85), pc });                // jne -> translated code is written
+                indexedOp(0x89, A, RDX);            // mov [rdx + rax], A
+                byte(0x43); byte(0xC6); modrm(1, 0, 4); byte(((R12 & 7) << 3) | (R13 & 7)); byte(0); byte(1);  // mov byte [r13 + r12], 1
+                byte(0x83); modrm(3, 0, RAX); byte(3);                  // add eax, 3
+                byte(0xC1); modrm(3, 5, RAX); byte(JIT_PAGE_BITS);      // shr eax, page bits
+                byte(0x41); byte(0xC6); modrm(1, 0, 4); byte((RAX << 3) | (R13 & 7)); byte(0); byte(1);     // mov byte [r13 + rax], 1
+                break;
+            case LOADI:
+                if(inROM(immediate))
+                    movRI(A, memory->read(immediate));                  // ROM never changes
+                else if(inRAM(immediate))
+                    displacedOp(0x8B, A, RDX, immediate - ramStart);    // mov A, [rdx + offset]
+                else
+                {
+                    exitTo(pc, JIT_EXIT_INTERPRET);
+                    ended = true;
+                }
+                break;
+            case STOREI:
+                if(inRAM(immediate))
+                {
+                    byte(0x80); modrm(2, 7, RBX); dword((immediate - ramStart) >> JIT_PAGE_BITS); byte(0);  // cmp byte [rbx + page], 0
+                    sideExits.push_back({ jump(0x85), pc });
+                    displacedOp(0x89, A, RDX, immediate - ramStart);    // mov [rdx + offset], A
+                    uint32_t first = (immediate - ramStart) >> JIT_PAGE_BITS;
+                    uint32_t last = (immediate - ramStart + 3) >> JIT_PAGE_BITS;
+                    for(uint32_t page = first; page <= last; page++)
+                    {
+                        byte(0x41); byte(0xC6); modrm(2, 0, R13); dword(page); byte(1);     // mov byte [r13 + page], 1
+                    }
+                }
+                else
+                {
+                    exitTo(pc, JIT_EXIT_INTERPRET);
+                    ended = true;
+                }
+                break;
+            case JMP:
+                branchTo(immediate);
+                ended = true;
+                break;
+            case JZ:
+            case JNZ:
+            {
+                byte(0x85); byte(0xC9);             // test ecx, ecx
+                uint8_t* taken = jump(operation == JZ ? 0x85 : 0x84);  // jnz / jz
+                branchTo(pc + 4);
+                patch(taken, code);
+                branchTo(immediate);
+                ended = true;
+                break;
+            }
+            case HLT:
+                exitTo(pc, JIT_EXIT_HALT);
+                ended = true;
+                break;
+            }
+
+            pc += 4;
+        }
+
+        // The word left to the interpreter is code too, translated stores over it have to exit so
+        // the interpreter's decoded copy is dropped
+        uint32_t end = interpret ? pc + 4 : pc;
+
+        if(pc == PC)                            // Nothing could be translated
+        {
+            code = block;
+            markCode(PC, end);
+            return nullptr;
+        }
+
+        if(interpret)
+            exitTo(pc, JIT_EXIT_INTERPRET);
+        else if(!ended)
+            branchTo(pc);                       // Block limit reached
+
+        for(auto& sideExit : sideExits)
+        {
+            patch(sideExit.first, code);
+            exitTo(sideExit.second, JIT_EXIT_INTERPRET);
+        }
+
+        markCode(PC, end);
+        blocks[PC] = block;
+
+        // Blocks that were waiting for this one now jump straight into it
+        auto waiting = links.find(PC);
+        if(waiting != links.end())
+        {
+            for(uint8_t* stub : waiting->second)
+            {
+                stub[0] = 0xE9;
+                patch(stub + 1, block);
+            }
+            links.erase(waiting);
+        }
+
+        return block;
+    }
+
+public:
+    JIT(MEMC* memory)
+    {
+        this->memory = memory;
+
+        romSize = memory->ROM_PARTITION_END;
+        ramStart = memory->ROM_PARTITION_END;
+        ramSize = memory->getRAM()->bytes() ? memory->RAM_PARTITION_END - memory->ROM_PARTITION_END : 0;
+        codePages = std::vector<uint8_t>((ramSize >> JIT_PAGE_BITS) + 1);
+
+        void* mapping = mmap(nullptr, JIT_BUFFER_BYTES, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED) throw std::runtime_error("Failed to map JIT buffer");
+        buffer = (uint8_t*)mapping;
+
+        state = JITState{};
+        state.rom = memory->getROM()->bytes();
+        state.ram = memory->getRAM()->bytes();
+        state.codePages = codePages.data();
+        state.dirtyPages = memory->dirtyPages();
+
+        flush();
+        memory->attach(this);
+    }
+
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+
+    ~JIT()
+    {
+        memory->detach(this);
+        munmap(buffer, JIT_BUFFER_BYTES);
+    }
+
+    void invalidate(uint32_t adress) override
+    {
+        if(adress < ramStart) return;
+
+        uint32_t page = (adress - ramStart) >> JIT_PAGE_BITS;
+        if(page < codePages.size() && codePages[page])
+            flush();                            // Simplest safe answer, chained jumps into the block go away with it
+    }
+
+    // Run translated code from PC until something has to go through the interpreter
+    JITExit run(uint32_t* registers, uint32_t& PC, bool& ZF)
+    {
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            state.registers[i] = registers[i];
+        state.PC = PC;
+        state.ZF = ZF;
+
+        JITExit reason = JIT_EXIT_BRANCH;
+        while(reason == JIT_EXIT_BRANCH)
+        {
+            auto block = blocks.find(state.PC);
+            uint8_t* entry = block != blocks.end() ? block->second : translate(state.PC);
+            if(!entry)
+            {
+                reason = JIT_EXIT_INTERPRET;
+                break;
+            }
+
+            state.entry = entry;
+            enter(&state);
+            reason = JITExit(state.exit);
+        }
+
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            registers[i] = state.registers[i];
+        PC = state.PC;
+        ZF = state.ZF;
+
+        return reason;
+    }
+};
+
+#endif
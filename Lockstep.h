@@ -0,0 +1,468 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "MemoryControler.h"
+#include "Instructions.h"
+#include "CPU.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"   // GCC 12 flags the undefined vectors inside the AVX-512 intrinsics
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+#endif
+
+// Lane operations of the lockstep interpreter, one guest per 32 bit lane. Masks have a bit per lane.
+#if defined(__AVX512F__)
+
+const int LOCKSTEP_LANES = 16;
+
+struct Lanes
+{
+    typedef __m512i Vector;
+
+    static Vector load(const uint32_t* lanes)                       { return _mm512_load_si512(lanes); }
+    static void store(uint32_t* lanes, Vector value)                { _mm512_store_si512(lanes, value); }
+    static Vector broadcast(uint32_t value)                         { return _mm512_set1_epi32(value); }
+    static Vector add(Vector a, Vector b)                           { return _mm512_add_epi32(a, b); }
+    static Vector sub(Vector a, Vector b)                           { return _mm512_sub_epi32(a, b); }
+    static Vector bitAnd(Vector a, Vector b)                        { return _mm512_and_si512(a, b); }
+    static Vector bitOr(Vector a, Vector b)                         { return _mm512_or_si512(a, b); }
+    static Vector shiftLeft(Vector a, uint32_t count)               { return _mm512_sllv_epi32(a, _mm512_set1_epi32(count)); }
+    static Vector shiftRight(Vector a, uint32_t count)              { return _mm512_srlv_epi32(a, _mm512_set1_epi32(count)); }
+    static uint32_t equal(Vector a, Vector b)                       { return _mm512_cmpeq_epi32_mask(a, b); }
+    static Vector select(uint32_t mask, Vector a, Vector b)         { return _mm512_mask_blend_epi32(mask, b, a); }   // mask ? a : b
+
+    static uint32_t minimum(Vector a)
+    {
+        a = _mm512_min_epu32(a, _mm512_shuffle_i32x4(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+        a = _mm512_min_epu32(a, _mm512_shuffle_i32x4(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+        a = _mm512_min_epu32(a, _mm512_shuffle_epi32(a, _MM_PERM_BADC));
+        a = _mm512_min_epu32(a, _mm512_shuffle_epi32(a, _MM_PERM_CDAB));
+        return _mm512_cvtsi512_si32(a);
+    }
+};
+
+#elif defined(__AVX2__)
+
+const int LOCKSTEP_LANES = 8;
+
+struct Lanes
+{
+    typedef __m256i Vector;
+
+    static Vector load(const uint32_t* lanes)                       { return _mm256_load_si256((const __m256i*)lanes); }
+    static void store(uint32_t* lanes, Vector value)                { _mm256_store_si256((__m256i*)lanes, value); }
+    static Vector broadcast(uint32_t value)                         { return _mm256_set1_epi32(value); }
+    static Vector add(Vector a, Vector b)                           { return _mm256_add_epi32(a, b); }
+    static Vector sub(Vector a, Vector b)                           { return _mm256_sub_epi32(a, b); }
+    static Vector bitAnd(Vector a, Vector b)                        { return _mm256_and_si256(a, b); }
+    static Vector bitOr(Vector a, Vector b)                         { return _mm256_or_si256(a, b); }
+    static Vector shiftLeft(Vector a, uint32_t count)               { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(count)); }
+    static Vector shiftRight(Vector a, uint32_t count)              { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(count)); }
+    static uint32_t equal(Vector a, Vector b)                       { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))); }
+
+    static Vector select(uint32_t mask, Vector a, Vector b)         // mask ? a : b
+    {
+        const Vector bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        Vector lanes = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), bits), bits);
+        return _mm256_blendv_epi8(b, a, lanes);
+    }
+
+    static uint32_t minimum(Vector a)
+    {
+        a = _mm256_min_epu32(a, _mm256_permute2x128_si256(a, a, 1));
+        a = _mm256_min_epu32(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+        a = _mm256_min_epu32(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm256_cvtsi256_si32(a);
+    }
+};
+
+#else
+
+const int LOCKSTEP_LANES = 8;
+
+// Plain loops over the lanes, the compiler vectorizes them for whatever the host has
+struct Lanes
+{
+    struct Vector
+    {
+        uint32_t lane[LOCKSTEP_LANES];
+    };
+
+    static Vector load(const uint32_t* lanes)
+    {
+        Vector value;
+        for(int i = 0; i < LOCKSTEP_LANES; i++) value.lane[i] = lanes[i];
+        return value;
+    }
+
+    static void store(uint32_t* lanes, Vector value)
+    {
+        for(int i = 0; i < LOCKSTEP_LANES; i++) lanes[i] = value.lane[i];
+    }
+
+    static Vector broadcast(uint32_t value)
+    {
+        Vector result;
+        for(int i = 0; i < LOCKSTEP_LANES; i++) result.lane[i] = value;
+        return result;
+    }
+
+    static Vector add(Vector a, Vector b)       { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] += b.lane[i]; return a; }
+    static Vector sub(Vector a, Vector b)       { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] -= b.lane[i]; return a; }
+    static Vector bitAnd(Vector a, Vector b)    { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] &= b.lane[i]; return a; }
+    static Vector bitOr(Vector a, Vector b)     { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] |= b.lane[i]; return a; }
+    static Vector shiftLeft(Vector a, uint32_t count)   { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] <<= count; return a; }
+    static Vector shiftRight(Vector a, uint32_t count)  { for(int i = 0; i < LOCKSTEP_LANES; i++) a.lane[i] >>= count; return a; }
+
+    static uint32_t equal(Vector a, Vector b)
+    {
+        uint32_t mask = 0;
+        for(int i = 0; i < LOCKSTEP_LANES; i++) mask |= uint32_t(a.lane[i] == b.lane[i]) << i;
+        return mask;
+    }
+
+    static Vector select(uint32_t mask, Vector a, Vector b)     // mask ? a : b
+    {
+        for(int i = 0; i < LOCKSTEP_LANES; i++)
+        {
+            uint32_t take = 0u - ((mask >> i) & 1);     // All ones for lanes in mask, no branch to mispredict
+            b.lane[i] = (a.lane[i] & take) | (b.lane[i] & ~take);
+        }
+        return b;
+    }
+
+    static uint32_t minimum(Vector a)
+    {
+        uint32_t result = a.lane[0];
+        for(int i = 1; i < LOCKSTEP_LANES; i++) if(a.lane[i] < result) result = a.lane[i];
+        return result;
+    }
+};
+
+#endif
+
+const int LOCKSTEP_VERIFIED_WORDS = 256;       // RAM instruction words remembered as the same in every lane
+
+inline int FirstLane(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int lane = 0;
+    while(!(mask & 1)) { mask >>= 1; lane++; }
+    return lane;
+#endif
+}
+
+// Runs LOCKSTEP_LANES guests over the same ROM at once, registers, PC and ZF kept as structure of
+// arrays. Every step takes the lowest PC among the running lanes and executes its instruction for
+// all lanes at that PC, so lanes that split at JZ/JNZ are masked off until the others catch up
+// with them. ALU operations run as vector operations under the lane mask, memory accesses go
+// lane by lane through each lane's own MEMC. Every lane ends exactly as CPU::run(budget) would.
+class LockstepCPU
+{
+private:
+    alignas(64) uint32_t registers[REGISTER_COUNT][LOCKSTEP_LANES];
+    alignas(64) uint32_t PC[LOCKSTEP_LANES];
+    alignas(64) uint32_t ZF[LOCKSTEP_LANES];
+
+    MEMC* memory[LOCKSTEP_LANES];               // nullptr for a lane without a guest
+    uint32_t used = 0;                          // Lanes with a guest
+    uint32_t halted = 0;                        // Lanes that ran into HLT or a trap without a handler
+    uint32_t trapped = 0;                       // Lanes halted by the trap, like the CPU's TRAPPED
+    uint64_t executed[LOCKSTEP_LANES];
+    uint32_t trapCause[LOCKSTEP_LANES];         // Trap state of every lane, like the CPU's
+    uint32_t trapPC[LOCKSTEP_LANES];
+    uint32_t trapHandler[LOCKSTEP_LANES];
+    uint64_t romEnd = 0;
+
+    // RAM words found to hold the same instruction in every lane, valid until the next store
+    struct VerifiedWord
+    {
+        uint32_t adress;
+        uint32_t instruction;
+        uint64_t epoch;
+    };
+    VerifiedWord verified[LOCKSTEP_VERIFIED_WORDS] = {};
+    uint64_t epoch = 1;                         // Counts stores, and runs since lanes may be written in between
+
+    void assign(uint32_t* lanes, uint32_t mask, Lanes::Vector value)
+    {
+        Lanes::store(lanes, Lanes::select(mask, value, Lanes::load(lanes)));
+    }
+
+    // The instruction at adress faulted in lane, go to its handler or halt the lane like CPU::trap()
+    void trap(int lane, uint32_t cause, uint32_t adress)
+    {
+        trapCause[lane] = cause;
+        trapPC[lane] = adress;
+        if(trapHandler[lane])
+        {
+            PC[lane] = trapHandler[lane];
+            trapHandler[lane] = 0;
+        }
+        else
+        {
+            halted |= 1u << lane;
+            trapped |= 1u << lane;
+        }
+    }
+
+    // Lanes in mask that also hold instruction at PC, the others wait for a later step
+    uint32_t sameInstruction(uint32_t mask, uint32_t adress, uint32_t instruction)
+    {
+        if(uint64_t(adress) + 3 < romEnd) return mask;     // All lanes share the ROM
+
+        VerifiedWord& word = verified[(adress >> 2) & (LOCKSTEP_VERIFIED_WORDS - 1)];
+        if(word.epoch == epoch && word.adress == adress && word.instruction == instruction)
+            return mask;
+
+        // Check every lane, not only the ones at PC, so the answer holds for any of them later on
+        bool same = true;
+        for(uint32_t rest = used; rest; rest &= rest - 1)
+        {
+            int lane = FirstLane(rest);
+            uint32_t word;
+            if(!memory[lane]->load(adress, word) && word == instruction) continue;     // A fault traps when it fetches on its own
+            mask &= ~(1u << lane);
+            same = false;
+        }
+
+        if(same) word = VerifiedWord{ adress, instruction, epoch };
+        return mask;
+    }
+
+    // Run one instruction for the lanes in mask
+    void execute(uint32_t mask, uint32_t adress, uint32_t instruction)
+    {
+        uint8_t operation = (instruction >> 24) & 0xFF;
+        uint8_t A = (instruction >> 20) & 0xF;
+        uint8_t B = (instruction >> 16) & 0xF;
+        uint32_t immediate = instruction & 0xFFFF;
+
+        if(A >= REGISTER_COUNT || B >= REGISTER_COUNT || operation > GETTRAP)
+        {
+            for(uint32_t rest = mask; rest; rest &= rest - 1)
+                trap(FirstLane(rest), FAULT_ILLEGAL, adress);
+            return;
+        }
+
+        Lanes::Vector next = Lanes::broadcast(adress + 4);
+
+        switch (operation)
+        {
+        case MVR:   assign(registers[A], mask, Lanes::load(registers[B]));     break;
+        case MVI:   assign(registers[A], mask, Lanes::broadcast(immediate));   break;
+        case ADDR:  assign(registers[A], mask, Lanes::add(Lanes::load(registers[A]), Lanes::load(registers[B])));     break;
+        case ADDI:  assign(registers[A], mask, Lanes::add(Lanes::load(registers[A]), Lanes::broadcast(immediate)));   break;
+        case SUBR:  assign(registers[A], mask, Lanes::sub(Lanes::load(registers[A]), Lanes::load(registers[B])));     break;
+        case SUBI:  assign(registers[A], mask, Lanes::sub(Lanes::load(registers[A]), Lanes::broadcast(immediate)));   break;
+        case ANDR:  assign(registers[A], mask, Lanes::bitAnd(Lanes::load(registers[A]), Lanes::load(registers[B])));  break;
+        case ANDI:  assign(registers[A], mask, Lanes::bitAnd(Lanes::load(registers[A]), Lanes::broadcast(immediate)));break;
+        case ORR:   assign(registers[A], mask, Lanes::bitOr(Lanes::load(registers[A]), Lanes::load(registers[B])));   break;
+        case ORI:   assign(registers[A], mask, Lanes::bitOr(Lanes::load(registers[A]), Lanes::broadcast(immediate))); break;
+        case LSL:   assign(registers[A], mask, Lanes::shiftLeft(Lanes::load(registers[A]), immediate & 31));          break;
+        case LSR:   assign(registers[A], mask, Lanes::shiftRight(Lanes::load(registers[A]), immediate & 31));         break;
+        case NOP:   break;
+        case CMP:
+        {
+            uint32_t equal = Lanes::equal(Lanes::load(registers[A]), Lanes::load(registers[B]));
+            assign(ZF, mask, Lanes::select(equal, Lanes::broadcast(1), Lanes::broadcast(0)));
+            break;
+        }
+        case JMP:
+            assign(PC, mask, Lanes::broadcast(immediate));
+            return;
+        case JZ:
+        case JNZ:
+        {
+            uint32_t zero = Lanes::equal(Lanes::load(ZF), Lanes::broadcast(0));     // Lanes with ZF false
+            uint32_t taken = operation == JZ ? ~zero : zero;
+            assign(PC, mask, Lanes::select(taken, Lanes::broadcast(immediate), next));
+            return;
+        }
+        case HLT:
+            halted |= mask;
+            return;
+        case COREID:    assign(registers[A], mask, Lanes::broadcast(0));    break;      // Every lane is a single core guest
+        case SETTRAP:
+            for(uint32_t rest = mask; rest; rest &= rest - 1)
+                trapHandler[FirstLane(rest)] = immediate;
+            break;
+        case GETTRAP:
+            for(uint32_t rest = mask; rest; rest &= rest - 1)
+            {
+                int lane = FirstLane(rest);
+                registers[A][lane] = trapCause[lane];
+                registers[B][lane] = trapPC[lane];
+                trapCause[lane] = FAULT_NONE;
+            }
+            break;
+        case LOADR:
+        case LOADI:
+        case STORER:
+        case STOREI:
+        case CAS:
+        case FADD:
+            if(operation != LOADR && operation != LOADI) epoch++;
+            for(uint32_t rest = mask; rest; rest &= rest - 1)
+            {
+                int lane = FirstLane(rest);
+                Fault fault;
+                if(operation == LOADR) fault = memory[lane]->load(registers[B][lane], registers[A][lane]);
+                else if(operation == LOADI) fault = memory[lane]->load(immediate, registers[A][lane]);
+                else if(operation == STORER) fault = memory[lane]->store(registers[B][lane], registers[A][lane]);
+                else if(operation == STOREI) fault = memory[lane]->store(immediate, registers[A][lane]);
+                else if(operation == FADD)
+                {
+                    uint32_t old;
+                    fault = memory[lane]->fetchAdd(registers[B][lane], registers[A][lane], old);
+                    if(!fault) registers[A][lane] = old;
+                }
+                else
+                {
+                    bool swapped;
+                    fault = memory[lane]->compareSwap(immediate, registers[A][lane], registers[B][lane], swapped);
+                    if(!fault) ZF[lane] = swapped;
+                }
+
+                if(fault)
+                {
+                    trap(lane, fault, adress);
+                    mask &= ~(1u << lane);      // PC is the handler's or stays on the faulting instruction
+                }
+            }
+            break;
+        }
+
+        assign(PC, mask, next);
+    }
+
+public:
+    // One MEMC per lane, all over the same ROM. Lanes past the end of memories (or nullptr) stay empty.
+    LockstepCPU(MEMC* const* memories, int count)
+    {
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            memory[lane] = lane < count ? memories[lane] : nullptr;
+            if(!memory[lane]) continue;
+
+            if(memory[lane]->getROM() != memory[FirstLane(used | (1u << lane))]->getROM())
+                throw std::runtime_error("Lockstep lanes have to share their ROM");
+
+            used |= 1u << lane;
+            romEnd = memory[lane]->ROM_PARTITION_END;
+        }
+
+        reset();
+    }
+
+    LockstepCPU(const LockstepCPU&) = delete;
+    LockstepCPU& operator=(const LockstepCPU&) = delete;
+
+    // Every lane starts over from adress 0 with cleared registers
+    void reset()
+    {
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            for(int i = 0; i < REGISTER_COUNT; i++)
+                registers[i][lane] = 0;
+            PC[lane] = 0;
+            ZF[lane] = 0;
+            executed[lane] = 0;
+            trapCause[lane] = FAULT_NONE;
+            trapPC[lane] = 0;
+            trapHandler[lane] = 0;
+        }
+        halted = 0;
+        trapped = 0;
+    }
+
+    // Run every lane until HLT, a trap without a handler, or budget instructions of its own
+    void run(uint64_t budget = UNLIMITED_BUDGET)
+    {
+        uint32_t running = used & ~halted;
+        epoch++;
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+            executed[lane] = 0;
+
+        while(running && budget)
+        {
+            // The lowest PC goes first, lanes ahead of it wait there for the others
+            uint32_t adress = Lanes::minimum(Lanes::select(running, Lanes::load(PC), Lanes::broadcast(~0u)));
+            uint32_t mask = Lanes::equal(Lanes::load(PC), Lanes::broadcast(adress)) & running;
+
+            int leader = FirstLane(mask);
+            uint32_t instruction;
+            if(Fault fault = memory[leader]->load(adress, instruction))
+            {
+                trap(leader, fault, adress);    // A fetch that faults still uses its budget
+                if(++executed[leader] == budget) running &= ~(1u << leader);
+                running &= ~halted;
+                continue;
+            }
+
+            mask = sameInstruction(mask, adress, instruction);
+
+            for(uint32_t rest = mask; rest; rest &= rest - 1)
+            {
+                int lane = FirstLane(rest);
+                if(++executed[lane] == budget) running &= ~(1u << lane);
+            }
+
+            execute(mask, adress, instruction);
+            running &= ~halted;
+        }
+    }
+
+    void setState(int lane, const CPUState& state)
+    {
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            registers[i][lane] = state.registers[i];
+        PC[lane] = state.PC;
+        ZF[lane] = state.ZF;
+        trapCause[lane] = state.trapCause;
+        trapPC[lane] = state.trapPC;
+        trapHandler[lane] = state.trapHandler;
+
+        halted &= ~(1u << lane);
+        trapped &= ~(1u << lane);
+        if(state.HALTED) halted |= 1u << lane;
+        if(state.TRAPPED) trapped |= 1u << lane;
+    }
+
+    CPUState getState(int lane) const
+    {
+        CPUState state;
+        for(int i = 0; i < REGISTER_COUNT; i++)
+            state.registers[i] = registers[i][lane];
+        state.PC = PC[lane];
+        state.HALTED = halted & (1u << lane);
+        state.ZF = ZF[lane];
+        state.trapCause = trapCause[lane];
+        state.trapPC = trapPC[lane];
+        state.trapHandler = trapHandler[lane];
+        state.TRAPPED = trapped & (1u << lane);
+        return state;
+    }
+
+    // Instructions the lane dispatched in the last run(), the faulting one included
+    uint64_t getExecuted(int lane) const
+    {
+        return executed[lane];
+    }
+
+    // Fault of the trap that halted the lane, FAULT_NONE unless one did
+    uint32_t getFault(int lane) const
+    {
+        return (trapped & (1u << lane)) ? trapCause[lane] : uint32_t(FAULT_NONE);
+    }
+};
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "Lockstep.h"
+
+const int DEFAULT_REPETITIONS = 100000;
+
+bool SameState(const CPUState& a, const CPUState& b)
+{
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        if(a.registers[i] != b.registers[i]) return false;
+
+    return a.PC == b.PC && a.HALTED == b.HALTED && a.ZF == b.ZF
+    && a.trapCause == b.trapCause && a.trapPC == b.trapPC && a.trapHandler == b.trapHandler
+    && a.TRAPPED == b.TRAPPED;
+}
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    int repetitions = argc > 1 ? std::atoi(argv[1]) : DEFAULT_REPETITIONS;
+
+    try
+    {
+        ROM rom(ROM_FILE_PATH);
+
+        // Every lane gets its own RAM, the ROM is shared
+        std::vector<std::unique_ptr<RAM>> rams;
+        std::vector<std::unique_ptr<MEMC>> memories;
+        std::vector<MEMC*> lanes;
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            rams.emplace_back(new RAM(MEMORY_SIZE_BYTES));
+            memories.emplace_back(new MEMC(&rom, rams.back().get()));
+            lanes.push_back(memories.back().get());
+        }
+
+        // The same lanes one at a time
+        uint64_t instructions = 0;
+        std::vector<CPUState> expected;
+        auto start = std::chrono::steady_clock::now();
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            CPU<NoTrace> cpu(lanes[lane], ENGINE_THREADED);
+            for(int i = 0; i < repetitions; i++)
+            {
+                cpu.reset();
+                instructions += cpu.run(UNLIMITED_BUDGET);
+            }
+            expected.push_back(cpu.getState());
+        }
+        double scalar = Seconds(start);
+
+        LockstepCPU lockstep(lanes.data(), lanes.size());
+        uint64_t lockstep_instructions = 0;
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < repetitions; i++)
+        {
+            lockstep.reset();
+            lockstep.run();
+            for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+                lockstep_instructions += lockstep.getExecuted(lane);
+        }
+        double vector = Seconds(start);
+
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++)
+        {
+            if(!SameState(lockstep.getState(lane), expected[lane]) || lockstep.getFault(lane) != FAULT_NONE)
+            {
+                std::cerr << "Lane " << lane << " disagrees with the scalar CPU\n";
+                return 1;
+            }
+        }
+        if(lockstep_instructions != instructions)
+        {
+            std::cerr << "Lockstep ran " << lockstep_instructions << " instructions instead of " << instructions << '\n';
+            return 1;
+        }
+
+        std::cout << LOCKSTEP_LANES << " lanes, " << instructions << " instructions\n";
+        std::cout << "one at a time: " << (instructions / scalar) / 1e6 << " MIPS\n";
+        std::cout << "lockstep:      " << (instructions / vector) / 1e6 << " MIPS (" << scalar / vector << "x)\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
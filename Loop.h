@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+
+#include "MemoryControler.h"
+#include "Instructions.h"
+
+const int LOOP_MAX_INSTRUCTIONS = 16;   // Longest loop body (CMP and JNZ included) worth analysing
+
+// What kind of loop ends in a backward CMP + JNZ
+enum LoopKind
+{
+    LOOP_NONE,          // Anything else, it runs instruction by instruction
+    LOOP_COUNTED,       // Only ADDI/SUBI, and ADDR/SUBR of registers the loop doesn't write
+    LOOP_COPY           // The bootloader copy: LOADR v,s  STORER v,d  ADDI s,4  ADDI d,4  LOADR t,s  ANDI t,mask  CMP t,e  JNZ
+};
+
+// A loop from head up to its CMP at compare, with the JNZ right after
+struct LoopShape
+{
+    LoopKind kind;
+    uint32_t length;                                    // Instructions per iteration
+
+    // LOOP_COUNTED: every iteration adds constant[r] + sum of scale[r][s] * register s to register r
+    uint32_t constant[REGISTER_COUNT];
+    uint32_t scale[REGISTER_COUNT][REGISTER_COUNT];
+    uint8_t compareA;
+    uint8_t compareB;
+
+    // LOOP_COPY registers and the ANDI mask
+    uint8_t value;
+    uint8_t source;
+    uint8_t destination;
+    uint8_t test;
+    uint8_t end;
+    uint32_t mask;
+};
+
+// Smallest i >= 1 with i * step == difference (mod 2^32), 0 when there is none
+inline uint64_t TripCount(uint32_t step, uint32_t difference)
+{
+    if(step == 0) return 0;
+
+    int shift = 0;
+    while(!((step >> shift) & 1)) shift++;
+    if(difference & ((1u << shift) - 1)) return 0;      // The low bits never line up
+
+    uint32_t odd = step >> shift;
+    uint32_t inverse = odd;                             // Right in 3 bits, every Newton step doubles that
+    for(int i = 0; i < 4; i++)
+        inverse *= 2 - odd * inverse;
+
+    uint64_t period = uint64_t(1) << (32 - shift);
+    uint64_t count = uint32_t((difference >> shift) * inverse) & (period - 1);
+    return count ? count : period;
+}
+
+// Look at the instructions from head up to the CMP at compare. Body words are marked as code,
+// so a write to any of them reaches the code caches and the analysis can be dropped.
+inline LoopShape AnalyzeLoop(MEMC* memory, uint32_t head, uint32_t compare)
+{
+    LoopShape loop = {};
+    loop.kind = LOOP_NONE;
+
+    if(head >= compare || (compare - head) % 4 != 0) return loop;
+    loop.length = (compare - head) / 4 + 2;
+    if(loop.length > uint32_t(LOOP_MAX_INSTRUCTIONS)) return loop;
+
+    uint32_t words[LOOP_MAX_INSTRUCTIONS];
+    for(uint32_t i = 0; i < loop.length; i++)
+    {
+        if(memory->load(head + 4 * i, words[i])) return loop;
+        memory->markCode(head + 4 * i);
+    }
+
+    uint8_t operation[LOOP_MAX_INSTRUCTIONS], A[LOOP_MAX_INSTRUCTIONS], B[LOOP_MAX_INSTRUCTIONS];
+    uint32_t immediate[LOOP_MAX_INSTRUCTIONS];
+    for(uint32_t i = 0; i < loop.length; i++)
+    {
+        operation[i] = words[i] >> 24;
+        A[i] = (words[i] >> 20) & 0xF;
+        B[i] = (words[i] >> 16) & 0xF;
+        immediate[i] = words[i] & 0xFFFF;
+        if(A[i] >= REGISTER_COUNT || B[i] >= REGISTER_COUNT) return loop;
+    }
+
+    uint32_t body = loop.length - 2;                    // Without the CMP and JNZ
+    if(operation[body] != CMP || operation[body + 1] != JNZ || immediate[body + 1] != head) return loop;
+    loop.compareA = A[body];
+    loop.compareB = B[body];
+
+    // The copy loop, matched as a whole
+    if(body == 6 && operation[0] == LOADR && operation[1] == STORER && operation[2] == ADDI && operation[3] == ADDI
+    && operation[4] == LOADR && operation[5] == ANDI)
+    {
+        uint8_t value = A[0], source = B[0], destination = B[1], test = A[4];
+        uint8_t end = loop.compareA == test ? loop.compareB : loop.compareA;
+
+        bool steps = immediate[2] == 4 && immediate[3] == 4
+        && ((A[2] == source && A[3] == destination) || (A[2] == destination && A[3] == source));
+
+        if(steps && A[1] == value && B[4] == source && A[5] == test && (loop.compareA == test || loop.compareB == test)
+        && source != destination && value != source && value != destination && value != end
+        && test != source && test != destination && test != end && end != source && end != destination)
+        {
+            loop.kind = LOOP_COPY;
+            loop.value = value;
+            loop.source = source;
+            loop.destination = destination;
+            loop.test = test;
+            loop.end = end;
+            loop.mask = immediate[5];
+        }
+        return loop;
+    }
+
+    // Counted loop, every register steps by an amount that doesn't change from one iteration to the next
+    bool written[REGISTER_COUNT] = {};
+    bool read[REGISTER_COUNT] = {};         // By an ADDR or SUBR, even when their scales cancel
+    for(uint32_t i = 0; i < body; i++)
+    {
+        switch (operation[i])
+        {
+        case ADDI:  loop.constant[A[i]] += immediate[i];    break;
+        case SUBI:  loop.constant[A[i]] -= immediate[i];    break;
+        case ADDR:  loop.scale[A[i]][B[i]] += 1;    read[B[i]] = true;  break;
+        case SUBR:  loop.scale[A[i]][B[i]] -= 1;    read[B[i]] = true;  break;
+        case NOP:   continue;
+        default:    return loop;
+        }
+        written[A[i]] = true;
+    }
+
+    for(int r = 0; r < REGISTER_COUNT; r++)
+        if(read[r] && written[r]) return loop;              // The step itself would change
+
+    loop.kind = LOOP_COUNTED;
+    return loop;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "MemoryControler.h"
+
+const int DEFAULT_LOADS = 1 << 26;
+const int ADRESS_COUNT = 1 << 16;       // Adresses cycled through by every run
+const int SPARSE_TOUCHED_PAGES = 1000;  // Pages written all over a sparse RAM that fills the adress space
+
+// Loads through the page table (read) and through the partition chain of the old MEMC (readPartition)
+template<bool PAGED>
+uint32_t Loads(const MEMC& memory, const std::vector<uint32_t>& adresses, int loads, const char* name)
+{
+    uint32_t sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < loads; i++)
+    {
+        uint32_t adress = adresses[i & (ADRESS_COUNT - 1)];
+        sum += PAGED ? memory.read(adress) : memory.readPartition(adress);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << (loads / seconds) / 1e6 << " M loads/s (" << (seconds * 1e9) / loads << " ns per load)\n";
+
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    int loads = argc > 1 ? std::atoi(argv[1]) : DEFAULT_LOADS;
+
+    try
+    {
+        ROM rom(ROM_FILE_PATH);
+        RAM ram(MEMORY_SIZE_BYTES);
+        MEMC memory_controler(&rom, &ram);
+
+        // Aligned words spread over ROM and RAM, like instruction fetches and LOADR
+        std::mt19937 random(1);
+        std::vector<uint32_t> adresses(ADRESS_COUNT);
+        for(uint32_t& adress : adresses)
+            adress = (random() % (memory_controler.RAM_PARTITION_END - 4)) & ~3u;
+
+        uint32_t partition = Loads<false>(memory_controler, adresses, loads, "partitions");
+        uint32_t paged = Loads<true>(memory_controler, adresses, loads, "page table");
+
+        if(partition != paged)
+        {
+            std::cerr << "Page table and partitions read different values\n";
+            return 1;
+        }
+
+        // The same RAM kept sparse, reads go through its page tables instead of the MEMC one
+        RAM sparse_ram(MEMORY_SIZE_BYTES, RAM_SPARSE);
+        MEMC sparse_controler(&rom, &sparse_ram);
+        for(uint32_t adress = 0; adress + 4 <= MEMORY_SIZE_BYTES; adress += 4)
+        {
+            uint32_t value = 0;
+            ram.read(adress, value);
+            sparse_ram.write(adress, value);
+        }
+
+        if(Loads<true>(sparse_controler, adresses, loads, "sparse RAM") != paged)
+        {
+            std::cerr << "Sparse and dense RAM read different values\n";
+            return 1;
+        }
+
+        // Host memory of a guest that owns the whole adress space but only writes a few pages
+        RAM huge_ram(ADRESS_SPACE_BYTES - rom.size(), RAM_SPARSE);
+        MEMC huge_controler(&rom, &huge_ram);
+        for(uint32_t i = 0; i < SPARSE_TOUCHED_PAGES; i++)
+            huge_controler.write(uint32_t(huge_controler.ROM_PARTITION_END) + uint32_t(random() % (huge_ram.size() - 4) & ~3u), i + 1);
+
+        std::cout << "sparse RAM of " << (huge_ram.size() >> 20) << " MB with " << SPARSE_TOUCHED_PAGES << " pages written: "
+        << huge_ram.resident() / 1024 << " KB resident\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
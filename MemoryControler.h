@@ -1,61 +1,561 @@
+#pragma once
+
 #include <iostream>
 #include <fstream>
 #include <cstdint>
+#include <cstring>
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 const int STORAGE_SIZE_BYTES = 1024 * 32; // 32 KB
+const int MEMORY_SIZE_BYTES = 1024;       // 1 KB
 const char ROM_FILE_PATH[] = "storage.img";
 
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MEMC_HAS_ATOMICS 1      // Guest atomics run as host atomics on the RAM word, elsewhere they take the MEMC lock
+#endif
+
+const int PAGE_BITS = 8;                        // 256 byte pages in the MEMC page table
+const uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+
+// Page permissions
+const uint8_t PAGE_READ = 0x1;
+const uint8_t PAGE_WRITE = 0x2;
+const uint8_t PAGE_CODE = 0x4;                  // Holds cached code, writes take the slow path to invalidate it
+const uint8_t PAGE_CLEAN = 0x8;                 // Unwritten since trackWrites(), the first write takes the slow path to mark it dirty
+
+// A guest page mapped straight onto host memory
+struct Page
+{
+    uint8_t* host;                              // Host adress of the first byte, nullptr when not mapped
+    uint8_t flags;
+};
+
+// How a RAM keeps its bytes
+enum RAMLayout
+{
+    RAM_DENSE,      // One zero filled block of the whole size, allocated up front
+    RAM_SPARSE      // Pages allocated on their first write, untouched pages read as zero
+};
+
+const int SPARSE_PAGE_BITS = 12;                            // 4 KB pages in a sparse RAM
+const uint32_t SPARSE_PAGE_SIZE = 1 << SPARSE_PAGE_BITS;
+const int SPARSE_TABLE_BITS = 8;                            // 256 pages (1 MB of RAM) per page table
+const uint32_t SPARSE_TABLE_ENTRIES = 1 << SPARSE_TABLE_BITS;
+const uint64_t ADRESS_SPACE_BYTES = uint64_t(1) << 32;      // ROM and RAM together
+
+// Why a memory access or an instruction couldn't run. The CPU traps with it instead of throwing,
+// host code that wants an exception uses the MEMC read()/write() wrappers.
+enum Fault
+{
+    FAULT_NONE,
+    FAULT_LOAD_RANGE,       // Load or fetch outside ROM, RAM and the devices
+    FAULT_STORE_RANGE,      // Store outside RAM and the devices
+    FAULT_ROM_WRITE,        // Store into ROM
+    FAULT_DEVICE_ALIGN,     // Device register accessed off a word boundary
+    FAULT_ATOMIC,           // Atomic on anything but an aligned RAM word
+    FAULT_ILLEGAL           // Unknown operation or register, raised by the CPU
+};
+
+inline const char* FaultName(uint32_t fault)
+{
+    static const char* const names[] = {
+        "No fault", "Memory access out of range", "Memory write out of range", "Cannot write to ROM",
+        "Unaligned device access", "Atomic access needs an aligned RAM word", "Illegal instruction"
+    };
+    return fault <= FAULT_ILLEGAL ? names[fault] : "Unknown fault";
+}
+
+// With MEMC_NO_BOUNDS_CHECKS defined RAM and ROM don't check that a word lies inside them. Only for
+// images validated to stay inside their memory, an access past the end reads or writes the host.
+#ifdef MEMC_NO_BOUNDS_CHECKS
+#define MEMC_OUTSIDE(adress, length) false
+#else
+#define MEMC_OUTSIDE(adress, length) (uint64_t(adress) + 3 >= (length))
+#endif
+
+// Aligned words are loaded and stored in one access, so cores sharing a RAM never see half a word
+// written. The accesses are relaxed atomics, which cost a plain move on the hosts we run on.
+inline uint32_t LoadWord(const uint8_t* host)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if((uintptr_t(host) & 3) == 0)
+        return __atomic_load_n((const uint32_t*)host, __ATOMIC_RELAXED);
+#endif
+
+    uint32_t value;
+    std::memcpy(&value, host, 4);
+    return value;
+}
+
+inline void StoreWord(uint8_t* host, uint32_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if((uintptr_t(host) & 3) == 0)
+    {
+        __atomic_store_n((uint32_t*)host, value, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+
+    std::memcpy(host, &value, 4);
+}
+
+// Page flags are set by any core running over a shared MEMC while the others read them. Flags are
+// only changed when they aren't already, a locked read-modify-write costs more than a whole store.
+inline uint8_t LoadFlags(const Page& page)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&page.flags, __ATOMIC_RELAXED);
+#else
+    return page.flags;
+#endif
+}
+
+inline void SetFlags(Page& page, uint8_t flags)
+{
+    if((LoadFlags(page) & flags) == flags) return;
+
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_or(&page.flags, flags, __ATOMIC_RELAXED);
+#else
+    page.flags |= flags;
+#endif
+}
+
+inline void ClearFlags(Page& page, uint8_t flags)
+{
+    if(!(LoadFlags(page) & flags)) return;
+
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_fetch_and(&page.flags, uint8_t(~flags), __ATOMIC_RELAXED);
+#else
+    page.flags &= ~flags;
+#endif
+}
+
+// Frozen copy of the bytes of a dense RAM, shared by snapshots and by the RAMs forked from them.
+// On Linux it is kept in an anonymous memory file, so forked RAMs can map it copy on write.
+class RAMImage
+{
+private:
+    std::vector<uint8_t> data;                              // Copy when there is no memory file
+    const uint8_t* image = nullptr;
+    size_t length = 0;
+    int file = -1;
+
+public:
+    RAMImage(const uint8_t* bytes, size_t size)
+    {
+        length = size;
+
+#if defined(__linux__)
+        file = size ? memfd_create("ram-image", MFD_CLOEXEC) : -1;
+        if(file >= 0)
+        {
+            void* mapping = MAP_FAILED;
+            if(ftruncate(file, size) == 0)
+                mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+            if(mapping != MAP_FAILED)
+            {
+                std::memcpy(mapping, bytes, size);
+                mprotect(mapping, size, PROT_READ);
+                image = (const uint8_t*)mapping;
+                return;
+            }
+
+            close(file);
+            file = -1;
+        }
+#endif
+
+        data = std::vector<uint8_t>(bytes, bytes + size);
+        image = data.data();
+    }
+
+    RAMImage(const RAMImage&) = delete;
+    RAMImage& operator=(const RAMImage&) = delete;
+
+    ~RAMImage()
+    {
+#if defined(__linux__)
+        if(file >= 0)
+        {
+            munmap((void*)image, length);
+            close(file);
+        }
+#endif
+    }
+
+    const uint8_t* bytes() const
+    {
+        return image;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    // Memory file holding the image, -1 when it is only a copy in this process
+    int descriptor() const
+    {
+        return file;
+    }
+};
+
 class RAM
 {
 private:
-    std::vector<uint8_t> data;
+    RAMLayout layout;
+    size_t length;
+
+    std::vector<uint8_t> data;                              // Bytes of a dense RAM made empty or copied
+    uint8_t* block = nullptr;                               // Bytes of a dense RAM, wherever they are
+    std::shared_ptr<const RAMImage> base;                   // Image a forked RAM maps, nullptr otherwise
+    bool mapped = false;                                    // block is a private mapping of base
+
+    // Two level page table of a sparse RAM. A table is made when a page in its 1 MB is first
+    // written and holds 4 byte page numbers (0 when the page isn't there), 1 KB per table.
+    std::vector<std::unique_ptr<uint32_t[]>> tables;
+    std::vector<std::unique_ptr<uint8_t[]>> pool;           // Page n is pool[n - 1]
+    size_t tableCount = 0;
+
+    const uint8_t* findPage(uint32_t adress) const
+    {
+        const std::unique_ptr<uint32_t[]>& table = tables[adress >> (SPARSE_PAGE_BITS + SPARSE_TABLE_BITS)];
+        if(!table) return nullptr;
+
+        uint32_t page = table[(adress >> SPARSE_PAGE_BITS) & (SPARSE_TABLE_ENTRIES - 1)];
+        return page ? pool[page - 1].get() : nullptr;
+    }
+
+    uint8_t* makePage(uint32_t adress)
+    {
+        std::unique_ptr<uint32_t[]>& table = tables[adress >> (SPARSE_PAGE_BITS + SPARSE_TABLE_BITS)];
+        if(!table)
+        {
+            table.reset(new uint32_t[SPARSE_TABLE_ENTRIES]());
+            tableCount++;
+        }
+
+        uint32_t& page = table[(adress >> SPARSE_PAGE_BITS) & (SPARSE_TABLE_ENTRIES - 1)];
+        if(!page)
+        {
+            pool.emplace_back(new uint8_t[SPARSE_PAGE_SIZE]());
+            page = pool.size();
+        }
+        return pool[page - 1].get();
+    }
+
+    uint32_t readSparse(uint32_t adress) const
+    {
+        uint32_t offset = adress & (SPARSE_PAGE_SIZE - 1);
+        if(offset <= SPARSE_PAGE_SIZE - 4)
+        {
+            const uint8_t* page = findPage(adress);
+            if(!page) return 0;                             // Never written
+
+            return (page[offset])
+            | (page[offset + 1] << 8)
+            | (page[offset + 2] << 16)
+            | (page[offset + 3] << 24);
+        }
+
+        uint32_t value = 0;                                 // The word goes on in the next page
+        for(uint32_t i = 0; i < 4; i++)
+        {
+            const uint8_t* page = findPage(adress + i);
+            if(page) value |= page[(adress + i) & (SPARSE_PAGE_SIZE - 1)] << (8 * i);
+        }
+        return value;
+    }
+
+    void writeSparse(uint32_t adress, uint32_t value)
+    {
+        for(uint32_t i = 0; i < 4; i++)
+        {
+            uint8_t byte = (value >> (8 * i)) & 0xFF;
+            uint8_t* page = const_cast<uint8_t*>(findPage(adress + i));
+            if(!page)
+            {
+                if(byte == 0) continue;                     // Untouched pages already read as zero
+                page = makePage(adress + i);
+            }
+            page[(adress + i) & (SPARSE_PAGE_SIZE - 1)] = byte;
+        }
+    }
 
 public:
-    RAM(size_t size_in_bytes) 
+    RAM(size_t size_in_bytes, RAMLayout layout = RAM_DENSE)
     {
-        data = std::vector<uint8_t>(size_in_bytes);
+        if(size_in_bytes > ADRESS_SPACE_BYTES)
+            throw std::runtime_error("RAM larger than the adress space");
+
+        this->layout = layout;
+        length = size_in_bytes;
+
+        if(layout == RAM_DENSE)
+        {
+            data = std::vector<uint8_t>(size_in_bytes);
+            block = data.data();
+        }
+        else
+            tables = std::vector<std::unique_ptr<uint32_t[]>>((size_in_bytes >> (SPARSE_PAGE_BITS + SPARSE_TABLE_BITS)) + 1);
     }
 
-    uint32_t read(uint32_t adress) const 
+    // Dense RAM forked from an image. Where the image has a memory file it is mapped privately,
+    // so pages the guest never writes stay shared with the image and every other fork of it.
+    RAM(std::shared_ptr<const RAMImage> image)
     {
-        if(adress + 3 >= data.size()) 
-            throw std::out_of_range("RAM access out of range");
+        layout = RAM_DENSE;
+        length = image->size();
+        base = image;
+
+#if defined(__linux__)
+        if(image->descriptor() >= 0)
+        {
+            void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->descriptor(), 0);
+            if(mapping != MAP_FAILED)
+            {
+                block = (uint8_t*)mapping;
+                mapped = true;
+                return;
+            }
+        }
+#endif
 
-        return (data[adress])           // Get the first byte  
-        | (data[adress + 1] << 8)       // Get the second byte then shift to the left by 1 byte
-        | (data[adress + 2] << 16)      // Get the third byte then shift to the left by 2 byte
-        | (data[adress + 3] << 24);     // Get the fourth byte then shift to the left by 3 byte
+        data = std::vector<uint8_t>(image->bytes(), image->bytes() + length);
+        block = data.data();
     }
 
-    void write(uint32_t adress, uint32_t value)
+    RAM(const RAM&) = delete;
+    RAM& operator=(const RAM&) = delete;
+
+    ~RAM()
     {
-        if(adress + 3 >= data.size()) 
-            throw std::out_of_range("RAM write out of range");
-        
-        data[adress] = value & 0xFF;                // The first byte is the first value byte
-        data[adress + 1] = (value >> 8) & 0xFF;     // The second byte is the second value byte
-        data[adress + 2] = (value >> 16) & 0xFF;    // The third byte is the third value byte
-        data[adress + 3] = (value >> 24) & 0xFF;    // The fourth byte is the fourth value byte
+#if defined(__linux__)
+        if(mapped) munmap(block, length);
+#endif
+    }
+
+    // value is left alone when the word isn't in RAM
+    Fault read(uint32_t adress, uint32_t& value) const 
+    {
+        if(MEMC_OUTSIDE(adress, length)) 
+            return FAULT_LOAD_RANGE;
+
+        if(layout == RAM_SPARSE)
+        {
+            value = readSparse(adress);
+            return FAULT_NONE;
+        }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = LoadWord(block + adress);               // Aligned words in one access
+#else
+        value = (block[adress])         // Get the first byte  
+        | (block[adress + 1] << 8)      // Get the second byte then shift to the left by 1 byte
+        | (block[adress + 2] << 16)     // Get the third byte then shift to the left by 2 byte
+        | (block[adress + 3] << 24);    // Get the fourth byte then shift to the left by 3 byte
+#endif
+        return FAULT_NONE;
+    }
+
+    Fault write(uint32_t adress, uint32_t value)
+    {
+        if(MEMC_OUTSIDE(adress, length)) 
+            return FAULT_STORE_RANGE;
+
+        if(layout == RAM_SPARSE)
+        {
+            writeSparse(adress, value);
+            return FAULT_NONE;
+        }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        StoreWord(block + adress, value);               // Aligned words in one access
+#else
+        block[adress] = value & 0xFF;               // The first byte is the first value byte
+        block[adress + 1] = (value >> 8) & 0xFF;    // The second byte is the second value byte
+        block[adress + 2] = (value >> 16) & 0xFF;   // The third byte is the third value byte
+        block[adress + 3] = (value >> 24) & 0xFF;   // The fourth byte is the fourth value byte
+#endif
+        return FAULT_NONE;
     }
 
     size_t size()
     {
-        return data.size();
+        return length;
+    }
+
+    // The bytes of a dense RAM, nullptr for a sparse one which has no single block to point at
+    uint8_t* bytes()
+    {
+        return block;
+    }
+
+    // Host memory holding the RAM contents and page tables, a forked RAM counts its shared pages too
+    size_t resident() const
+    {
+        if(layout == RAM_DENSE)
+            return length;
+
+        return tables.size() * sizeof(tables[0])
+        + tableCount * SPARSE_TABLE_ENTRIES * sizeof(uint32_t)
+        + pool.size() * (sizeof(pool[0]) + SPARSE_PAGE_SIZE);
+    }
+};
+
+// How a ROM gets its image from a file
+enum ROMLoad
+{
+    ROM_MAP,        // Map the file read only, ROMs of the same file share the mapping
+    ROM_COPY        // Read the whole file into memory owned by the ROM
+};
+
+// A read only mapping of an image file, shared by every ROM that maps the same file
+class ImageMapping
+{
+private:
+    const uint8_t* image = nullptr;
+    size_t length = 0;
+
+public:
+    ImageMapping(const char* image_file_path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int file = open(image_file_path, O_RDONLY);
+        if(file < 0) throw std::runtime_error("Failed to open file");
+
+        struct stat status;
+        if(fstat(file, &status) != 0)
+        {
+            close(file);
+            throw std::runtime_error("Failed to read file size");
+        }
+        length = status.st_size;
+
+        if(length > 0)
+        {
+            void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+            close(file);                                    // The mapping stays valid without the descriptor
+            if(mapping == MAP_FAILED) throw std::runtime_error("Failed to map file");
+            image = (const uint8_t*)mapping;
+        }
+        else close(file);
+#else
+        throw std::runtime_error("Mapping files isn't supported on this host");
+#endif
+    }
+
+    ImageMapping(const ImageMapping&) = delete;
+    ImageMapping& operator=(const ImageMapping&) = delete;
+
+    ~ImageMapping()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if(image) munmap((void*)image, length);
+#endif
+    }
+
+    const uint8_t* bytes() const
+    {
+        return image;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    // The mapping of a file, made on first use and kept while any ROM still uses it
+    static std::shared_ptr<const ImageMapping> get(const char* image_file_path)
+    {
+        static std::mutex lock;
+        static std::map<std::string, std::weak_ptr<const ImageMapping>> mappings;
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::weak_ptr<const ImageMapping>& known = mappings[image_file_path];
+        std::shared_ptr<const ImageMapping> mapping = known.lock();
+        if(!mapping)
+        {
+            mapping = std::make_shared<const ImageMapping>(image_file_path);
+            known = mapping;
+        }
+        return mapping;
     }
 };
 
 class ROM
 {
 private:
-    std::vector<uint8_t> data;
+    std::vector<uint8_t> data;                          // Image of a copied ROM
+    std::shared_ptr<const ImageMapping> mapping;        // Image of a mapped ROM
+
+    const uint8_t* image = nullptr;                     // First byte of the image, wherever it is
+    size_t length = 0;
 
 public:
     ROM() {}
-    ROM(const char* rom_file_path)
+    ROM(const uint8_t* bytes, size_t size)
     {
+        data = std::vector<uint8_t>(bytes, bytes + size);   // Image already in memory, no file to read
+        image = data.data();
+        length = data.size();
+    }
+
+    // Image of instruction words, like one assembled at compile time into the binary. The words
+    // have to outlive the ROM: on little endian hosts they are used where they are, nothing is
+    // read or copied.
+    ROM(const uint32_t* words, size_t count)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        image = (const uint8_t*)words;
+        length = count * 4;
+#else
+        for(size_t i = 0; i < count; i++)
+            for(int shift = 0; shift < 32; shift += 8)
+                data.push_back((words[i] >> shift) & 0xFF);
+
+        image = data.data();
+        length = data.size();
+#endif
+    }
+
+    template<size_t N>
+    ROM(const std::array<uint32_t, N>& words) : ROM(words.data(), N) {}
+
+    // size_in_bytes is the size the image has to have, 0 takes any size
+    ROM(const char* rom_file_path, size_t size_in_bytes = STORAGE_SIZE_BYTES, ROMLoad load = ROM_MAP)
+    {
+        if(load == ROM_MAP)
+        {
+            mapping = ImageMapping::get(rom_file_path);
+            image = mapping->bytes();
+            length = mapping->size();
+
+            if(size_in_bytes != 0 && length != size_in_bytes)
+                throw std::runtime_error("Invalid ROM size " + std::to_string(length) + " Bytes");
+            return;
+        }
+
         // Check if the file is the right size
-        std::streamsize rom_file_size;
+        std::streamsize rom_file_size = 0;
         std::ifstream file(rom_file_path, std::ios::ate);
         if(!file) throw std::runtime_error("Failed to open file");
         if(file.is_open())
@@ -64,7 +564,7 @@ public:
             file.close();
         }
 
-        if(rom_file_size != STORAGE_SIZE_BYTES) 
+        if(size_in_bytes != 0 && rom_file_size != std::streamsize(size_in_bytes)) 
             throw std::runtime_error("Invalid ROM size " + std::to_string(rom_file_size) + " Bytes");
 
         // Load the ROM data
@@ -74,33 +574,199 @@ public:
         uint8_t byte;
         while(rom.read((char*)(&byte), sizeof(uint8_t))) 
             data.push_back(byte);
+
+        image = data.data();
+        length = data.size();
     }
 
-    uint32_t read(uint32_t adress) const 
+    ROM(const ROM&) = delete;
+    ROM& operator=(const ROM&) = delete;
+
+    // value is left alone when the word isn't in ROM
+    Fault read(uint32_t adress, uint32_t& value) const 
     {
-        if(adress >= data.size()) throw std::out_of_range("ROM access out of range");
+        if(MEMC_OUTSIDE(adress, length)) return FAULT_LOAD_RANGE;
 
-        return (data[adress])           
-        | (data[adress + 1] << 8)       
-        | (data[adress + 2] << 16)      
-        | (data[adress + 3] << 24);     
+        value = (image[adress])           
+        | (image[adress + 1] << 8)       
+        | (image[adress + 2] << 16)      
+        | (image[adress + 3] << 24);     
+        return FAULT_NONE;
     }
 
     size_t size()
     {
-        return data.size();
+        return length;
+    }
+
+    const uint8_t* bytes() const
+    {
+        return image;
     }
 };
 
+// Anything that keeps decoded or translated code and has to drop it when that memory is written
+class CodeCache
+{
+public:
+    virtual void invalidate(uint32_t adress) = 0;   // The word at adress was written
+};
+
+// A memory mapped device in the I/O hole above RAM. Guests reach its registers with aligned word
+// loads and stores; reads must not change anything, the CPU may read ahead of the PC.
+class Device
+{
+public:
+    virtual uint32_t read(uint32_t offset) = 0;                 // offset from the base of the device
+    virtual void write(uint32_t offset, uint32_t value) = 0;
+};
+
 class MEMC
 {
 private:
     ROM* rom;
     RAM* ram;
 
+    std::vector<CodeCache*> caches;                 // Code caches told about writes to PAGE_CODE pages
+    std::vector<Page> pages;                        // Page table over ROM and RAM
+    std::vector<uint8_t> dirty;                     // One byte per RAM page (from the RAM start), set when written, empty for a sparse RAM
+
+    struct DeviceMapping
+    {
+        uint32_t base;
+        uint32_t size;
+        Device* device;
+    };
+    std::vector<DeviceMapping> devices;             // Above RAM, only reached through the slow path
+
+    bool shared = false;                            // Cores on several host threads run over this MEMC
+    mutable std::recursive_mutex lock;              // Serializes the slow path of a shared MEMC and atomics without host support
+
+    // Holds the lock while a shared MEMC changes its bookkeeping or talks to a device. Recursive,
+    // the DMA controller writes RAM from inside a device store.
+    std::unique_lock<std::recursive_mutex> serialize() const
+    {
+        if(shared) return std::unique_lock<std::recursive_mutex>(lock);
+        return std::unique_lock<std::recursive_mutex>(lock, std::defer_lock);
+    }
+
+    // A mapped RAM page without cached code or write tracking, its stores need no bookkeeping
+    bool plain(uint32_t adress) const
+    {
+        uint32_t page = adress >> PAGE_BITS;
+        return page < pages.size() && LoadFlags(pages[page]) == (PAGE_READ | PAGE_WRITE);
+    }
+
+    // The RAM word at adress was written: its pages are dirty and code caches hear about it
+    void written(uint32_t adress)
+    {
+        uint32_t offset = adress - ROM_PARTITION_END;
+        if(!dirty.empty())
+        {
+            dirty[offset >> PAGE_BITS] = 1;
+            dirty[(offset + 3) >> PAGE_BITS] = 1;
+        }
+        for(uint32_t page : { adress >> PAGE_BITS, (adress + 3) >> PAGE_BITS })
+            if(page < pages.size()) ClearFlags(pages[page], PAGE_CLEAN);
+
+        for(CodeCache* cache : caches)                      // The written word may hold cached code
+            cache->invalidate(adress);
+    }
+
+    Fault storeLocked(uint32_t adress, uint32_t value)
+    {
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        return storeUnlocked(adress, value);
+    }
+
+    // Slow path store, the lock of a shared MEMC is held
+    Fault storeUnlocked(uint32_t adress, uint32_t value)
+    {
+        if(adress < ROM_PARTITION_END)
+            return FAULT_ROM_WRITE;
+        else if(adress < RAM_PARTITION_END)
+        {
+            if(Fault fault = ram->write(adress - ROM_PARTITION_END, value))   // Writing to RAM memory at adress offset
+                return fault;
+        }
+        else if(const DeviceMapping* mapping = findDevice(adress))
+        {
+            if((adress & 3) || adress - mapping->base > mapping->size - 4)
+                return FAULT_DEVICE_ALIGN;
+
+            mapping->device->write(adress - mapping->base, value);
+            return FAULT_NONE;                              // Device registers are neither RAM nor code
+        }
+        else 
+            return FAULT_STORE_RANGE;
+
+        written(adress);
+        return FAULT_NONE;
+    }
+
+    // Host word of the aligned RAM word at adress for the host's atomics, nullptr when there isn't
+    // one (sparse RAM, no atomics) or the adress isn't an aligned RAM word (fault says which).
+    uint32_t* atomicWord(uint32_t adress, Fault& fault)
+    {
+        fault = FAULT_NONE;
+        if(adress < ROM_PARTITION_END)
+            fault = FAULT_ROM_WRITE;
+        else if((adress & 3) || uint64_t(adress) + 4 > RAM_PARTITION_END)
+            fault = FAULT_ATOMIC;
+        if(fault) return nullptr;
+
+#ifdef MEMC_HAS_ATOMICS
+        uint8_t* bytes = ram->bytes();
+        if(bytes && (uintptr_t(bytes + (adress - ROM_PARTITION_END)) & 3) == 0)
+            return (uint32_t*)(bytes + (adress - ROM_PARTITION_END));
+#endif
+        return nullptr;
+    }
+
+    // Device the word at adress belongs to, nullptr where there is none. Callers check that the
+    // access is an aligned word inside the device.
+    const DeviceMapping* findDevice(uint32_t adress) const
+    {
+        for(const DeviceMapping& mapping : devices)
+            if(adress - mapping.base < mapping.size)
+                return &mapping;
+
+        return nullptr;
+    }
+
+    [[noreturn]] static void raise(Fault fault, uint32_t adress)
+    {
+        throw std::runtime_error(std::string(FaultName(fault)) + " at adress " + std::to_string(adress));
+    }
+
+    // Map every page that lies completely inside one partition, the rest stays on the slow path.
+    // A sparse RAM isn't mapped at all: its pages only exist once written, and a table over a
+    // large RAM would cost more host memory than the pages the guest touches.
+    void mapPages()
+    {
+        uint64_t mapped_end = ram->bytes() ? RAM_PARTITION_END : ROM_PARTITION_END;
+        pages = std::vector<Page>((mapped_end + PAGE_SIZE - 1) >> PAGE_BITS, Page{ nullptr, 0 });
+
+        uint16_t probe = 1;
+        uint8_t first_byte;
+        std::memcpy(&first_byte, &probe, 1);
+        if(first_byte != 1) return;                 // The fast path loads words as they are, which needs a little endian host
+
+        for(uint32_t page = 0; page < pages.size(); page++)
+        {
+            uint64_t start = uint64_t(page) << PAGE_BITS;
+            uint64_t end = start + PAGE_SIZE;
+
+            if(end <= ROM_PARTITION_END)
+                pages[page] = Page{ const_cast<uint8_t*>(rom->bytes()) + start, PAGE_READ };
+            else if(start >= ROM_PARTITION_END && end <= RAM_PARTITION_END)
+                pages[page] = Page{ ram->bytes() + (start - ROM_PARTITION_END), uint8_t(PAGE_READ | PAGE_WRITE) };
+        }
+    }
+
 public:
-    uint32_t ROM_PARTITION_END;
-    uint32_t RAM_PARTITION_END;
+    uint64_t ROM_PARTITION_END;
+    uint64_t RAM_PARTITION_END;                             // Up to 1 << 32 when RAM fills the adress space
 
     MEMC() {}
     MEMC(ROM* rom, RAM* ram)
@@ -110,25 +776,314 @@ public:
 
         ROM_PARTITION_END = rom->size();                        // ROM PARTITION
         RAM_PARTITION_END = ROM_PARTITION_END + ram->size();    // RAM PARTITION
+
+        if(RAM_PARTITION_END > ADRESS_SPACE_BYTES)
+            throw std::runtime_error("ROM and RAM don't fit the adress space");
+
+        mapPages();
+        if(ram->bytes())                                        // Only a dense RAM can be restored from the written pages
+            dirty = std::vector<uint8_t>((ram->size() + PAGE_SIZE - 1) >> PAGE_BITS);
     }
 
-    uint32_t read(uint32_t adress) const
+    // Aligned words inside a mapped page are a table lookup and a load, everything else
+    // (page crossing words, unmapped pages, faults) goes through the partitions. Faults are
+    // returned, value is left alone then.
+    Fault load(uint32_t adress, uint32_t& value) const
+    {
+        uint32_t page = adress >> PAGE_BITS;
+        uint32_t offset = adress & (PAGE_SIZE - 1);
+
+        if(page < pages.size() && (LoadFlags(pages[page]) & PAGE_READ) && offset <= PAGE_SIZE - 4)
+        {
+            value = LoadWord(pages[page].host + offset);
+            return FAULT_NONE;
+        }
+
+        return loadPartition(adress, value);
+    }
+
+    Fault store(uint32_t adress, uint32_t value) 
+    {
+        uint32_t page = adress >> PAGE_BITS;
+        uint32_t offset = adress & (PAGE_SIZE - 1);
+
+        if(page < pages.size() && LoadFlags(pages[page]) == (PAGE_READ | PAGE_WRITE) && offset <= PAGE_SIZE - 4)
+        {
+            StoreWord(pages[page].host + offset, value);
+            return FAULT_NONE;
+        }
+
+        return storePartition(adress, value);
+    }
+
+    // Slow path, finds the partition of the adress without the page table
+    Fault loadPartition(uint32_t adress, uint32_t& value) const
     {
         if(adress < ROM_PARTITION_END)                          
-            return rom->read(adress);
+            return rom->read(adress, value);
         else if(adress < RAM_PARTITION_END)
-            return ram->read(adress - ROM_PARTITION_END);   // Reading from RAM at adress offset
+            return ram->read(adress - ROM_PARTITION_END, value);   // Reading from RAM at adress offset
+        else if(const DeviceMapping* mapping = findDevice(adress))
+        {
+            if((adress & 3) || adress - mapping->base > mapping->size - 4)
+                return FAULT_DEVICE_ALIGN;
+
+            std::unique_lock<std::recursive_mutex> guard = serialize();
+            value = mapping->device->read(adress - mapping->base);
+            return FAULT_NONE;
+        }
         else 
-            throw std::out_of_range("Memory acces out of range" );
+            return FAULT_LOAD_RANGE;
+    }
+
+    Fault storePartition(uint32_t adress, uint32_t value) 
+    {
+        if(shared) return storeLocked(adress, value);
+        return storeUnlocked(adress, value);
+    }
+
+    // Host side wrappers that throw std::runtime_error on a fault, for code outside the CPU
+    uint32_t read(uint32_t adress) const
+    {
+        uint32_t value;
+        if(Fault fault = load(adress, value)) raise(fault, adress);
+        return value;
     }
 
     void write(uint32_t adress, uint32_t value) 
     {
-        if(adress < ROM_PARTITION_END)
-            throw std::runtime_error("Cannot write to ROM");
-        else if(adress < RAM_PARTITION_END)
-            ram->write(adress - ROM_PARTITION_END, value);   // Writing to RAM memory at adress offset
-        else 
-            throw std::out_of_range("Memory write out of range");
+        if(Fault fault = store(adress, value)) raise(fault, adress);
+    }
+
+    uint32_t readPartition(uint32_t adress) const
+    {
+        uint32_t value;
+        if(Fault fault = loadPartition(adress, value)) raise(fault, adress);
+        return value;
+    }
+
+    // Compare and swap on the RAM word at adress: when it holds expected it gets desired and swapped
+    // is true, otherwise expected gets what it holds. Sequentially consistent between cores.
+    Fault compareSwap(uint32_t adress, uint32_t& expected, uint32_t desired, bool& swapped)
+    {
+        Fault fault;
+        uint32_t* word = atomicWord(adress, fault);
+        if(fault) return fault;
+
+#ifdef MEMC_HAS_ATOMICS
+        if(word)
+        {
+            swapped = __atomic_compare_exchange_n(word, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            if(swapped && !plain(adress))
+            {
+                std::unique_lock<std::recursive_mutex> guard = serialize();
+                written(adress);
+            }
+            return FAULT_NONE;
+        }
+#endif
+
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        uint32_t value;
+        if((fault = loadPartition(adress, value))) return fault;
+
+        swapped = value == expected;
+        if(!swapped)
+        {
+            expected = value;
+            return FAULT_NONE;
+        }
+        return storeUnlocked(adress, desired);
+    }
+
+    // Add value to the RAM word at adress, old gets what it held before. Sequentially consistent.
+    Fault fetchAdd(uint32_t adress, uint32_t value, uint32_t& old)
+    {
+        Fault fault;
+        uint32_t* word = atomicWord(adress, fault);
+        if(fault) return fault;
+
+#ifdef MEMC_HAS_ATOMICS
+        if(word)
+        {
+            old = __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST);
+            if(!plain(adress))
+            {
+                std::unique_lock<std::recursive_mutex> guard = serialize();
+                written(adress);
+            }
+            return FAULT_NONE;
+        }
+#endif
+
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        uint32_t current;
+        if((fault = loadPartition(adress, current))) return fault;
+        if((fault = storeUnlocked(adress, current + value))) return fault;
+        old = current;
+        return FAULT_NONE;
+    }
+
+    // Copy words from source to destination like a loop of read() and write() would. Runs of words
+    // inside one readable page and one plain RAM page are moved at once, everything else (pages
+    // with cached code, clean pages, faults) goes a word at a time through write(). A shared MEMC
+    // always goes a word at a time, memmove doesn't keep words whole for the other cores. Stops at
+    // the first fault and returns it, the words before it are copied.
+    Fault copy(uint32_t destination, uint32_t source, uint64_t words)
+    {
+        while(words)
+        {
+            uint32_t from = source >> PAGE_BITS;
+            uint32_t to = destination >> PAGE_BITS;
+            uint32_t from_offset = source & (PAGE_SIZE - 1);
+            uint32_t to_offset = destination & (PAGE_SIZE - 1);
+            uint64_t run = 1;
+
+            if(!shared
+            && from < pages.size() && (pages[from].flags & PAGE_READ) && from_offset <= PAGE_SIZE - 4
+            && to < pages.size() && pages[to].flags == (PAGE_READ | PAGE_WRITE) && to_offset <= PAGE_SIZE - 4)
+            {
+                run = std::min<uint64_t>(words, std::min(PAGE_SIZE - from_offset, PAGE_SIZE - to_offset) / 4);
+                std::memmove(pages[to].host + to_offset, pages[from].host + from_offset, run * 4);
+            }
+            else
+            {
+                uint32_t value;
+                if(Fault fault = load(source, value)) return fault;
+                if(Fault fault = store(destination, value)) return fault;
+            }
+
+            source += run * 4;
+            destination += run * 4;
+            words -= run;
+        }
+        return FAULT_NONE;
+    }
+
+    // Set RAM to bytes followed by zeros, for reusing the memory with another input. Only words that
+    // change are written, so pages holding cached code only tell the caches about what really changed.
+    void loadRAM(const uint8_t* bytes, size_t size)
+    {
+        for(uint64_t offset = 0; offset + 4 <= ram->size(); offset += 4)
+        {
+            uint32_t value = 0;
+            for(uint64_t i = 0; i < 4 && offset + i < size; i++)
+                value |= uint32_t(bytes[offset + i]) << (8 * i);
+
+            uint32_t adress = ROM_PARTITION_END + offset;
+            if(read(adress) != value)
+                write(adress, value);
+        }
+    }
+
+    // Start counting written RAM pages from zero. Mapped RAM pages go back to the slow path until
+    // their first write, so afterwards a write costs nothing more.
+    void trackWrites()
+    {
+        std::fill(dirty.begin(), dirty.end(), 0);
+
+        for(Page& page : pages)
+            if(page.flags & PAGE_WRITE) page.flags |= PAGE_CLEAN;
+    }
+
+    // Copy image back over the RAM pages written since trackWrites(), or over all of them, and
+    // track writes again. Code caches hear about every word of a restored page that holds code.
+    void restoreRAM(const uint8_t* image, bool all_pages)
+    {
+        uint8_t* bytes = ram->bytes();
+        if(!bytes) throw std::runtime_error("Only a dense RAM can be restored");
+
+        for(uint64_t page = 0; page < dirty.size(); page++)
+        {
+            if(!dirty[page] && !all_pages) continue;
+
+            uint64_t start = page << PAGE_BITS;
+            uint64_t end = std::min<uint64_t>(start + PAGE_SIZE, ram->size());
+            if(std::memcmp(bytes + start, image + start, end - start) == 0) continue;
+
+            std::memcpy(bytes + start, image + start, end - start);
+
+            bool code = false;                      // The RAM page can lie across two MEMC pages
+            for(uint64_t table = (ROM_PARTITION_END + start) >> PAGE_BITS; table <= (ROM_PARTITION_END + end - 1) >> PAGE_BITS; table++)
+                code |= table < pages.size() && (pages[table].flags & PAGE_CODE);
+
+            if(code)
+                for(uint64_t offset = start & ~uint64_t(3); offset < end; offset += 4)
+                    for(CodeCache* cache : caches)
+                        cache->invalidate(ROM_PARTITION_END + offset);
+        }
+
+        trackWrites();
+    }
+
+    // Written flags of the RAM pages, translated code sets them itself since its stores skip MEMC
+    uint8_t* dirtyPages()
+    {
+        return dirty.data();
+    }
+
+    // A code cache keeps code decoded from the word at adress, writes to its pages have to tell the caches
+    void markCode(uint32_t adress)
+    {
+        uint32_t first = adress >> PAGE_BITS;
+        uint32_t last = (adress + 3) >> PAGE_BITS;
+
+        if(first < pages.size()) SetFlags(pages[first], PAGE_CODE);
+        if(last < pages.size()) SetFlags(pages[last], PAGE_CODE);
+    }
+
+    // Map size bytes of device registers at base. The range has to lie above RAM and clear of the
+    // other devices.
+    void mapDevice(uint32_t base, uint32_t size, Device* device)
+    {
+        if(base < RAM_PARTITION_END || size < 4 || base > ~0u - (size - 1))
+            throw std::runtime_error("Device doesn't fit above RAM");
+
+        for(const DeviceMapping& mapping : devices)
+            if(base - mapping.base < mapping.size || mapping.base - base < size)
+                throw std::runtime_error("Device overlaps another device");
+
+        devices.push_back(DeviceMapping{ base, size, device });
+    }
+
+    // Let cores on several host threads run over this MEMC at once. Aligned RAM words are read
+    // and written whole, the slow path and devices take a lock and copies go a word at a time.
+    // Needs a dense RAM that starts at a word boundary; code caches attach before the cores start.
+    void share()
+    {
+        if(!ram->bytes()) throw std::runtime_error("Only a dense RAM can be shared");
+        if(ROM_PARTITION_END % 4) throw std::runtime_error("A shared RAM has to start at a word boundary");
+
+        shared = true;
+    }
+
+    bool isShared() const
+    {
+        return shared;
+    }
+
+    ROM* getROM()
+    {
+        return rom;
+    }
+
+    RAM* getRAM()
+    {
+        return ram;
+    }
+
+    void attach(CodeCache* cache)
+    {
+        caches.push_back(cache);
+    }
+
+    void detach(CodeCache* cache)
+    {
+        for(size_t i = 0; i < caches.size(); i++)
+            if(caches[i] == cache)
+            {
+                caches.erase(caches.begin() + i);
+                break;
+            }
     }
 };
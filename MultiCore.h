@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "CPU.h"
+#include "DMA.h"
+#include "Console.h"
+
+const uint64_t CORE_SLICE = 1 << 16;        // Instructions a core runs between looks at whether another one trapped
+
+// Several CPU cores over one dense RAM and a shared MEMC, each core on its own host thread while
+// they run. Core n starts at adress 0 like a single CPU and gets n from COREID, so guests split
+// their work by core ID or hand it out with CAS and FADD. Aligned RAM words are atomic between
+// cores, anything more has to be built from the atomics; code a core writes for the others is
+// only picked up by them at their next atomic. The DMA controller and the console sit in the I/O
+// hole like on a Machine.
+template<typename TracePolicy = NoTrace>
+class MultiCore
+{
+private:
+    RAM ram;
+    MEMC memory;
+    DMA dma;
+    Console console;
+    std::vector<std::unique_ptr<CPU<TracePolicy>>> cores;
+
+public:
+    MultiCore(ROM* rom, unsigned core_count, size_t ram_size = MEMORY_SIZE_BYTES, Engine engine = ENGINE_THREADED)
+        : ram(ram_size), memory(rom, &ram), dma(&memory)
+    {
+        memory.share();
+
+        if(memory.RAM_PARTITION_END <= DMA_BASE)
+            memory.mapDevice(DMA_BASE, DMA_SIZE, &dma);
+        if(memory.RAM_PARTITION_END <= CONSOLE_BASE)
+            memory.mapDevice(CONSOLE_BASE, CONSOLE_SIZE, &console);
+
+        for(unsigned core = 0; core < core_count; core++)
+            cores.emplace_back(new CPU<TracePolicy>(&memory, engine, core));
+    }
+
+    MultiCore(const MultiCore&) = delete;
+    MultiCore& operator=(const MultiCore&) = delete;
+
+    // Run every core until all of them halted and return the instructions they dispatched together.
+    // A core that halts on a trap stops the others at the end of their slice, getCore() tells which
+    // one by its TRAPPED flag.
+    uint64_t run()
+    {
+        std::atomic<bool> stopping{ false };
+        std::atomic<uint64_t> executed{ 0 };
+
+        std::vector<std::thread> threads;
+        for(std::unique_ptr<CPU<TracePolicy>>& core : cores)
+        {
+            CPU<TracePolicy>* cpu = core.get();
+            threads.emplace_back([&, cpu]()
+            {
+                uint64_t count = 0;
+                while(!cpu->getState().HALTED && !stopping.load(std::memory_order_relaxed))
+                    count += cpu->run(CORE_SLICE);
+
+                CPUState state = cpu->getState();
+                if(state.TRAPPED)
+                    stopping.store(true, std::memory_order_relaxed);
+                executed.fetch_add(count, std::memory_order_relaxed);
+            });
+        }
+
+        for(std::thread& thread : threads)
+            thread.join();
+
+        return executed.load();
+    }
+
+    // Every core back to adress 0, RAM stays as it is
+    void reset()
+    {
+        for(std::unique_ptr<CPU<TracePolicy>>& core : cores)
+            core->reset();
+    }
+
+    CPU<TracePolicy>& getCore(unsigned core)
+    {
+        return *cores[core];
+    }
+
+    unsigned getCoreCount() const
+    {
+        return cores.size();
+    }
+
+    MEMC& getMemory()
+    {
+        return memory;
+    }
+
+    RAM& getRAM()
+    {
+        return ram;
+    }
+
+    Console& getConsole()
+    {
+        return console;
+    }
+};
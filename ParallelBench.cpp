@@ -0,0 +1,140 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "Assembler.h"
+#include "MultiCore.h"
+
+// Parallel sum of a RAM array on 1, 2, 4 ... cores. Cores take chunks of the array with CAS on a
+// shared cursor, leave their partial sum in a slot picked by COREID and add it to the total with
+// FADD. The same guest runs on every core count, only the number of cores changes.
+
+const uint32_t DEFAULT_WORDS = 1 << 22;     // 16 MB array
+const int DEFAULT_RUNS = 5;
+
+const uint32_t SUM_RAM = STORAGE_SIZE_BYTES;    // RAM starts right after the 32 KB ROM
+const uint32_t SUM_CURSOR = SUM_RAM;            // Adress of the next chunk nobody took yet
+const uint32_t SUM_END = SUM_RAM + 0x4;         // Adress right after the array
+const uint32_t SUM_TOTAL = SUM_RAM + 0x8;
+const uint32_t SUM_PARTIALS = SUM_RAM + 0x10;   // One word per core
+const uint32_t SUM_ARRAY = SUM_RAM + 0x1000;
+const uint32_t SUM_CHUNK_BYTES = 0x1000;
+const unsigned SUM_MAX_CORES = (SUM_ARRAY - SUM_PARTIALS) / 4;
+
+std::vector<uint32_t> ParallelSum()
+{
+    return
+    {
+        EncInstr(MVI, 0, 0, 0),                         // 0   Partial sum
+
+        // Take a chunk
+        EncInstr(LOADI, 1, 0, SUM_CURSOR),              // 1   0x04 Expected cursor
+        EncInstr(LOADI, 2, 0, SUM_END),                 // 2   0x08
+        EncInstr(CMP, 1, 2),                            // 3
+        EncInstr(JZ, 0, 0, 0x3C),                       // 4   Nothing left
+        EncInstr(MVR, 2, 1),                            // 5
+        EncInstr(ADDI, 2, 0, SUM_CHUNK_BYTES),          // 6   Cursor after the chunk, also where it ends
+        EncInstr(CAS, 1, 2, SUM_CURSOR),                // 7
+        EncInstr(JNZ, 0, 0, 0x08),                      // 8   Another core was first, R1 has the new cursor
+
+        // Add the chunk from R1 to R2
+        EncInstr(LOADR, 3, 1),                          // 9   0x24
+        EncInstr(ADDR, 0, 3),                           // 10
+        EncInstr(ADDI, 1, 0, 4),                        // 11
+        EncInstr(CMP, 1, 2),                            // 12
+        EncInstr(JNZ, 0, 0, 0x24),                      // 13
+        EncInstr(JMP, 0, 0, 0x04),                      // 14
+
+        // Leave the partial sum in the core's slot and add it to the total
+        EncInstr(COREID, 1, 0),                         // 15  0x3C
+        EncInstr(LSL, 1, 0, 2),                         // 16
+        EncInstr(ADDI, 1, 0, SUM_PARTIALS),             // 17
+        EncInstr(STORER, 0, 1),                         // 18
+        EncInstr(MVI, 1, 0, SUM_TOTAL),                 // 19
+        EncInstr(FADD, 0, 1),                           // 20
+        EncInstr(HLT, 0, 0)                             // 21
+    };
+}
+
+void WriteWord(uint8_t* ram, uint32_t adress, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+        ram[adress - SUM_RAM + i] = (value >> (8 * i)) & 0xFF;
+}
+
+uint32_t ReadWord(const uint8_t* ram, uint32_t adress)
+{
+    uint32_t value = 0;
+    for(int i = 0; i < 4; i++)
+        value |= uint32_t(ram[adress - SUM_RAM + i]) << (8 * i);
+    return value;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t words = argc > 1 ? std::atoi(argv[1]) : DEFAULT_WORDS;
+    int runs = argc > 2 ? std::atoi(argv[2]) : DEFAULT_RUNS;
+    unsigned max_cores = argc > 3 ? std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    words = (words + SUM_CHUNK_BYTES / 4 - 1) / (SUM_CHUNK_BYTES / 4) * (SUM_CHUNK_BYTES / 4);
+
+    try
+    {
+        std::vector<uint8_t> image = ImageBytes(ParallelSum(), STORAGE_SIZE_BYTES);
+        ROM rom(image.data(), image.size());
+
+        uint32_t expected = 0;
+        for(uint32_t i = 0; i < words; i++)
+            expected += i * 2654435761u;
+
+        double single = 0;
+
+        std::cout << words << " words, " << std::thread::hardware_concurrency() << " host threads\n";
+        for(unsigned cores = 1; cores <= std::min(max_cores, SUM_MAX_CORES); cores *= 2)
+        {
+            MultiCore<NoTrace> machine(&rom, cores, SUM_ARRAY - SUM_RAM + uint64_t(words) * 4);
+            uint8_t* ram = machine.getRAM().bytes();
+            for(uint32_t i = 0; i < words; i++)
+                WriteWord(ram, SUM_ARRAY + 4 * i, i * 2654435761u);
+            WriteWord(ram, SUM_END, SUM_ARRAY + words * 4);
+
+            double best = 0;
+            uint64_t instructions = 0;
+            for(int run = 0; run < runs; run++)
+            {
+                WriteWord(ram, SUM_CURSOR, SUM_ARRAY);
+                WriteWord(ram, SUM_TOTAL, 0);
+                machine.reset();
+
+                auto start = std::chrono::steady_clock::now();
+                instructions = machine.run();
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if(run == 0 || seconds < best) best = seconds;
+
+                uint32_t partials = 0;
+                for(unsigned core = 0; core < cores; core++)
+                    partials += ReadWord(ram, SUM_PARTIALS + 4 * core);
+
+                if(ReadWord(ram, SUM_TOTAL) != expected || partials != expected)
+                {
+                    std::cerr << cores << " cores summed wrong\n";
+                    return 1;
+                }
+            }
+
+            if(cores == 1) single = best;
+            std::cout << cores << " cores: " << best * 1e3 << " ms, " << instructions / best / 1e6 << " MIPS, "
+                      << single / best << "x the single core\n";
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
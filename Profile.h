@@ -0,0 +1,234 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+
+#include "Instructions.h"
+
+const int PROFILE_PAGE_BITS = 12;               // Bytes of code per page of PC counters
+const int PROFILE_HOTSPOTS = 20;                // Hottest PCs listed in the report
+const char PROFILE_REPORT_PATH[] = "profile.txt";
+const char PROFILE_FOLDED_PATH[] = "profile.folded";
+
+inline const char* OperationName(uint32_t operation)
+{
+    static const char* const names[] = {
+        "MVR", "MVI", "ADDR", "ADDI", "SUBR", "SUBI", "CMP", "JMP", "JZ", "JNZ", "HLT",
+        "NOP", "LOADR", "LOADI", "STORER", "STOREI", "ANDR", "ANDI", "ORR", "ORI", "LSR", "LSL",
+        "CAS", "FADD", "COREID", "SETTRAP", "GETTRAP"
+    };
+    return operation <= GETTRAP ? names[operation] : "???";
+}
+
+// Counts where the program spends its instructions: executions per operation and per PC, taken
+// and not taken JZ/JNZ per branch, loads and stores per partition, and the basic blocks as they
+// are entered at run time (a block starts after a jump or HLT, or wherever the PC lands off the
+// straight line). At halt it writes a text report and a folded stack file (block;operation count)
+// for flamegraph.pl or speedscope. With any other policy nothing of this is compiled in.
+class ProfileTrace
+{
+private:
+    struct Hit
+    {
+        uint64_t count;
+        uint32_t instruction;                   // Last instruction seen at the PC
+    };
+
+    struct Branch
+    {
+        uint32_t operation;                     // JZ or JNZ
+        uint64_t taken;
+        uint64_t notTaken;
+    };
+
+    struct Block
+    {
+        uint32_t end;                           // PC of the last instruction
+        uint64_t entries;
+        uint64_t instructions;
+        uint64_t operations[GETTRAP + 2];       // The last one counts illegal operations
+    };
+
+    uint64_t executed = 0;
+    uint64_t operations[256] = {};
+    uint64_t loads[2] = {};                     // RAM, ROM
+    uint64_t stores[2] = {};
+
+    // Per PC counters, one entry per aligned word, in pages made when code in them first runs
+    std::unordered_map<uint32_t, std::unique_ptr<Hit[]>> hits;
+    Hit* hitPage = nullptr;                     // Page of the last step
+    uint32_t hitPageNumber = ~0u;
+
+    std::unordered_map<uint32_t, Branch> branches;
+    std::unordered_map<uint32_t, Block> blocks; // By first PC, elements keep their adress on rehash
+    Block* block = nullptr;                     // Block of the last step
+    uint32_t nextPC = 0;                        // Where the block goes on without a new one
+    bool blockEnded = true;                     // Last step was a jump or HLT
+
+    std::string reportPath;
+    std::string foldedPath;
+    bool written = false;
+
+    static std::string Hex(uint32_t value)
+    {
+        std::ostringstream text;
+        text << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+        return text.str();
+    }
+
+    static double Percent(uint64_t part, uint64_t whole)
+    {
+        return whole ? 100.0 * part / whole : 0.0;
+    }
+
+    void writeReport(std::ostream& out)
+    {
+        out << std::fixed << std::setprecision(1);
+        out << "Profile of " << executed << " instructions\n";
+
+        out << "\nOperations\n";
+        for(int operation = 0; operation < 256; operation++)
+        {
+            if(!operations[operation]) continue;
+            out << "  " << std::left << std::setw(8) << OperationName(operation) << std::right
+                << std::setw(14) << operations[operation] << std::setw(7) << Percent(operations[operation], executed) << "%\n";
+        }
+
+        std::vector<std::pair<uint32_t, const Hit*>> hot;
+        for(const auto& page : hits)
+            for(uint32_t i = 0; i < (1u << PROFILE_PAGE_BITS) / 4; i++)
+                if(page.second[i].count)
+                    hot.emplace_back((page.first << PROFILE_PAGE_BITS) | (i * 4), &page.second[i]);
+        size_t shown = std::min<size_t>(hot.size(), PROFILE_HOTSPOTS);
+        std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(),
+            [](const std::pair<uint32_t, const Hit*>& a, const std::pair<uint32_t, const Hit*>& b)
+            { return a.second->count != b.second->count ? a.second->count > b.second->count : a.first < b.first; });
+
+        out << "\nHot PCs\n";
+        for(size_t i = 0; i < shown; i++)
+            out << "  " << Hex(hot[i].first) << "  " << std::left << std::setw(8) << OperationName(hot[i].second->instruction >> 24) << std::right
+                << std::setw(14) << hot[i].second->count << std::setw(7) << Percent(hot[i].second->count, executed) << "%\n";
+
+        std::vector<std::pair<uint32_t, Branch>> sorted_branches(branches.begin(), branches.end());
+        std::sort(sorted_branches.begin(), sorted_branches.end(),
+            [](const std::pair<uint32_t, Branch>& a, const std::pair<uint32_t, Branch>& b) { return a.first < b.first; });
+
+        out << "\nBranches\n";
+        for(const auto& branch : sorted_branches)
+            out << "  " << Hex(branch.first) << "  " << std::left << std::setw(4) << OperationName(branch.second.operation) << std::right
+                << "  taken " << branch.second.taken << ", not taken " << branch.second.notTaken
+                << " (" << Percent(branch.second.taken, branch.second.taken + branch.second.notTaken) << "% taken)\n";
+
+        out << "\nMemory\n";
+        out << "  ROM  loads " << loads[1] << ", stores " << stores[1] << '\n';
+        out << "  RAM  loads " << loads[0] << ", stores " << stores[0] << '\n';
+
+        std::vector<std::pair<uint32_t, const Block*>> sorted_blocks;
+        for(const auto& entry : blocks)
+            sorted_blocks.emplace_back(entry.first, &entry.second);
+        std::sort(sorted_blocks.begin(), sorted_blocks.end(),
+            [](const std::pair<uint32_t, const Block*>& a, const std::pair<uint32_t, const Block*>& b)
+            { return a.second->instructions != b.second->instructions ? a.second->instructions > b.second->instructions : a.first < b.first; });
+
+        out << "\nBlocks\n";
+        for(const auto& entry : sorted_blocks)
+            out << "  " << Hex(entry.first) << "-" << Hex(entry.second->end) << "  entries " << entry.second->entries
+                << ", instructions " << entry.second->instructions << " (" << Percent(entry.second->instructions, executed) << "%)\n";
+    }
+
+    // One line per block and operation, "block_0x00000010;ADDI 480"
+    void writeFolded(std::ostream& out)
+    {
+        for(const auto& entry : blocks)
+            for(int operation = 0; operation <= GETTRAP + 1; operation++)
+                if(entry.second.operations[operation])
+                    out << "block_" << Hex(entry.first) << ';' << OperationName(operation) << ' ' << entry.second.operations[operation] << '\n';
+    }
+
+    void write()
+    {
+        written = true;
+
+        std::ofstream report(reportPath);
+        std::ofstream folded(foldedPath);
+        if(!report || !folded)
+        {
+            std::cerr << "Failed to open the profile files\n";
+            return;
+        }
+
+        writeReport(report);
+        writeFolded(folded);
+        std::cout << "Profile written to " << reportPath << " and " << foldedPath << '\n';
+    }
+
+public:
+    ProfileTrace(const char* report_path = PROFILE_REPORT_PATH, const char* folded_path = PROFILE_FOLDED_PATH)
+        : reportPath(report_path), foldedPath(folded_path) {}
+
+    ProfileTrace(const ProfileTrace&) = delete;
+    ProfileTrace& operator=(const ProfileTrace&) = delete;
+
+    ~ProfileTrace()
+    {
+        if(!written && executed) write();       // Keep the profile of a run that ended with an error
+    }
+
+    void step(uint32_t PC, uint32_t instruction, const uint32_t* /*registers*/, bool ZF, uint32_t /*nextPC*/)
+    {
+        uint32_t operation = instruction >> 24;
+        executed++;
+        operations[operation]++;
+
+        uint32_t page = PC >> PROFILE_PAGE_BITS;
+        if(page != hitPageNumber)
+        {
+            std::unique_ptr<Hit[]>& entry = hits[page];
+            if(!entry) entry.reset(new Hit[(1u << PROFILE_PAGE_BITS) / 4]());
+            hitPage = entry.get();
+            hitPageNumber = page;
+        }
+        Hit& hit = hitPage[(PC & ((1u << PROFILE_PAGE_BITS) - 1)) >> 2];     // Unaligned PCs count with their word
+        hit.count++;
+        hit.instruction = instruction;
+
+        if(blockEnded || PC != nextPC)
+        {
+            block = &blocks[PC];
+            block->entries++;
+        }
+        block->end = PC;
+        block->instructions++;
+        block->operations[std::min<uint32_t>(operation, GETTRAP + 1)]++;
+
+        nextPC = PC + 4;
+        blockEnded = operation == JMP || operation == JZ || operation == JNZ || operation == HLT;
+
+        if(operation == JZ || operation == JNZ)
+        {
+            Branch& branch = branches[PC];
+            branch.operation = operation;
+            if((operation == JZ) == ZF) branch.taken++;     // Jumps leave ZF as it was
+            else branch.notTaken++;
+        }
+    }
+
+    void access(uint32_t /*adress*/, bool store, bool rom)
+    {
+        if(store) stores[rom]++;
+        else loads[rom]++;
+    }
+
+    void halt(uint32_t /*PC*/, const uint32_t* /*registers*/, bool /*ZF*/)
+    {
+        write();
+    }
+};
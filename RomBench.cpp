@@ -0,0 +1,79 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "MemoryControler.h"
+
+const size_t DEFAULT_IMAGE_MB = 64;
+const char BENCH_IMAGE_PATH[] = "bench_rom.img";
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Read one word per host page, what a guest touching its data tables would pay for at first
+uint32_t Touch(ROM& rom)
+{
+    uint32_t sum = 0;
+    for(size_t adress = 0; adress + 4 <= rom.size(); adress += 4096)
+    {
+        uint32_t value = 0;
+        rom.read(adress, value);
+        sum += value;
+    }
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t image_size = (argc > 1 ? std::atoi(argv[1]) : DEFAULT_IMAGE_MB) * 1024 * 1024;
+
+    try
+    {
+        {
+            std::vector<uint8_t> image(image_size);
+            for(size_t i = 0; i < image_size; i++)
+                image[i] = uint8_t(i * 7);
+
+            std::ofstream file(BENCH_IMAGE_PATH, std::ios::binary);
+            file.write((const char*)(image.data()), image.size());
+        }
+
+        std::cout << "Image: " << image_size / (1024 * 1024) << " MB\n";
+
+        auto start = std::chrono::steady_clock::now();
+        ROM copied(BENCH_IMAGE_PATH, image_size, ROM_COPY);
+        std::cout << "copy loader:   " << Seconds(start) * 1e3 << " ms\n";
+
+        start = std::chrono::steady_clock::now();
+        ROM mapped(BENCH_IMAGE_PATH, image_size, ROM_MAP);
+        std::cout << "mapped:        " << Seconds(start) * 1e3 << " ms\n";
+
+        start = std::chrono::steady_clock::now();
+        ROM shared(BENCH_IMAGE_PATH, image_size, ROM_MAP);
+        std::cout << "second mapped: " << Seconds(start) * 1e3 << " ms (same mapping: " << (shared.bytes() == mapped.bytes() ? "yes" : "no") << ")\n";
+
+        start = std::chrono::steady_clock::now();
+        uint32_t mapped_sum = Touch(mapped);
+        std::cout << "first touch of every page of the mapping: " << Seconds(start) * 1e3 << " ms\n";
+
+        if(mapped_sum != Touch(copied))
+        {
+            std::cerr << "Mapped and copied images differ\n";
+            return 1;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    std::remove(BENCH_IMAGE_PATH);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "CPU.h"
+#include "DMA.h"
+#include "Console.h"
+
+// Registers, PC, flags and RAM of a machine at one point. Snapshots only hold immutable data,
+// so copies are cheap and any number of machines can restore or fork from the same one.
+struct Snapshot
+{
+    CPUState state;
+    std::shared_ptr<const RAMImage> ram;
+};
+
+// A RAM, its MEMC and a CPU over a shared ROM, with snapshots of the whole state. After a snapshot
+// or restore the MEMC counts which RAM pages get written, so restoring the same snapshot again
+// only copies those pages back. A machine forked from a snapshot maps the snapshot's RAM copy on
+// write, untouched pages stay shared between all forks of it. Snapshots need a dense RAM.
+// A DMA controller and a console (printing to std::cout) sit in the I/O hole when RAM ends below
+// them; device registers aren't part of snapshots.
+template<typename TracePolicy = NoTrace>
+class Machine
+{
+private:
+    std::shared_ptr<const RAMImage> baseline;   // Image the written pages are counted against, nullptr before the first snapshot
+    RAM ram;
+    MEMC memory;
+    DMA dma;
+    Console console;
+    CPU<TracePolicy> cpu;
+
+    void mapDevices()
+    {
+        if(memory.RAM_PARTITION_END <= DMA_BASE)
+            memory.mapDevice(DMA_BASE, DMA_SIZE, &dma);
+        if(memory.RAM_PARTITION_END <= CONSOLE_BASE)
+            memory.mapDevice(CONSOLE_BASE, CONSOLE_SIZE, &console);
+    }
+
+public:
+    Machine(ROM* rom, size_t ram_size = MEMORY_SIZE_BYTES, Engine engine = ENGINE_HANDLER, RAMLayout layout = RAM_DENSE)
+        : ram(ram_size, layout), memory(rom, &ram), dma(&memory), cpu(&memory, engine)
+    {
+        mapDevices();
+    }
+
+    // Starts in the state of snapshot, rom has to be the ROM it was taken over
+    Machine(ROM* rom, const Snapshot& snapshot, Engine engine = ENGINE_HANDLER)
+        : baseline(snapshot.ram), ram(snapshot.ram), memory(rom, &ram), dma(&memory), cpu(&memory, engine)
+    {
+        mapDevices();
+        cpu.setState(snapshot.state);
+        memory.trackWrites();
+    }
+
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    Snapshot snapshot()
+    {
+        if(!ram.bytes()) throw std::runtime_error("Only a dense RAM can be snapshotted");
+
+        baseline = std::make_shared<const RAMImage>(ram.bytes(), ram.size());
+        memory.trackWrites();
+        return Snapshot{ cpu.getState(), baseline };
+    }
+
+    // Back to snapshot. Coming from the last snapshot taken or restored only the written pages are
+    // copied, from any other snapshot the whole RAM is.
+    void restore(const Snapshot& snapshot)
+    {
+        if(snapshot.ram->size() != ram.size())
+            throw std::runtime_error("Snapshot RAM size doesn't match");
+
+        memory.restoreRAM(snapshot.ram->bytes(), snapshot.ram != baseline);
+        baseline = snapshot.ram;
+        cpu.setState(snapshot.state);
+    }
+
+    CPU<TracePolicy>& getCPU()
+    {
+        return cpu;
+    }
+
+    MEMC& getMemory()
+    {
+        return memory;
+    }
+
+    RAM& getRAM()
+    {
+        return ram;
+    }
+
+    DMA& getDMA()
+    {
+        return dma;
+    }
+
+    Console& getConsole()
+    {
+        return console;
+    }
+};
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "Snapshot.h"
+
+const int DEFAULT_RUNS = 100000;
+const size_t FORK_RAM_BYTES = 16 * 1024 * 1024;     // RAM of the forked machines, 16 MB each
+const int FORKS = 64;
+
+// Resident memory of this process, 0 where /proc isn't there
+size_t Resident()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if(statm >> size >> resident) return resident * sysconf(_SC_PAGESIZE);
+#endif
+    return 0;
+}
+
+// Step through the bootloader until it jumps into the program copied to RAM
+template<typename TracePolicy>
+void Boot(Machine<TracePolicy>& machine)
+{
+    CPU<TracePolicy>& cpu = machine.getCPU();
+    while(cpu.getState().PC != machine.getMemory().ROM_PARTITION_END)
+    {
+        if(cpu.getState().HALTED) throw std::runtime_error("Halted before leaving the bootloader");
+        cpu.step();
+    }
+}
+
+bool SameState(const CPUState& a, const CPUState& b)
+{
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        if(a.registers[i] != b.registers[i]) return false;
+
+    return a.PC == b.PC && a.HALTED == b.HALTED && a.ZF == b.ZF;
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = argc > 1 ? std::atoi(argv[1]) : DEFAULT_RUNS;
+
+    try
+    {
+        ROM rom(ROM_FILE_PATH);
+
+        Machine<NoTrace> machine(&rom);
+        Boot(machine);
+        Snapshot booted = machine.snapshot();
+        machine.getCPU().run();
+        CPUState expected = machine.getCPU().getState();
+
+        // Every run from scratch: new RAM, MEMC and CPU, and the whole bootloader copy loop
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < runs; i++)
+        {
+            Machine<NoTrace> fresh(&rom);
+            fresh.getCPU().run();
+            if(!SameState(fresh.getCPU().getState(), expected)) throw std::runtime_error("Fresh run differs");
+        }
+        double cold = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Every run from the booted snapshot, which only copies back the pages the last run wrote
+        double restoring = 0;
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < runs; i++)
+        {
+            auto restore_start = std::chrono::steady_clock::now();
+            machine.restore(booted);
+            restoring += std::chrono::duration<double>(std::chrono::steady_clock::now() - restore_start).count();
+
+            machine.getCPU().run();
+            if(!SameState(machine.getCPU().getState(), expected)) throw std::runtime_error("Restored run differs");
+        }
+        double warm = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "boot and run : " << (cold * 1e6) / runs << " us per run\n";
+        std::cout << "restore, run : " << (warm * 1e6) / runs << " us per run (restore " << (restoring * 1e6) / runs << " us), "
+                  << cold / warm << "x\n";
+
+        // Forks of one booted machine with a large RAM share every page they don't write
+        Machine<NoTrace> parent(&rom, FORK_RAM_BYTES);
+        Boot(parent);
+        Snapshot parent_booted = parent.snapshot();
+
+        size_t before = Resident();
+        std::vector<std::unique_ptr<Machine<NoTrace>>> forks;
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < FORKS; i++)
+        {
+            forks.emplace_back(new Machine<NoTrace>(&rom, parent_booted));
+            forks.back()->getCPU().run();
+            if(!SameState(forks.back()->getCPU().getState(), expected)) throw std::runtime_error("Forked run differs");
+        }
+        double forking = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t after = Resident();
+
+        std::cout << FORKS << " forks of " << FORK_RAM_BYTES / (1024 * 1024) << " MB RAM: " << (forking * 1e6) / FORKS << " us per fork and run, ";
+        if(before && after) std::cout << (after - before) / 1024 << " KB more resident";
+        else std::cout << "resident size unknown";
+        std::cout << " (" << (uint64_t(FORKS) * FORK_RAM_BYTES) / (1024 * 1024) << " MB as copies)\n";
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Assembler.h"
+#include "Bootloader.h"
+
+// The program storage.img boots: multiplies R0 by R1 into R3, assembled to run from RAM
+constexpr std::array<uint32_t, 9> MULTIPLY_PROGRAM = Assemble(BOOT_RAM_ADRESS,
+{
+    // Set registers
+    Op(MVI, 0, 0, 120),                 // 0 What to multiply
+    Op(MVI, 1, 0, 5),                   // 1 How much times to multiply
+    Op(MVI, 2, 0, 0),                   // 2 How much times we multiplyed
+    Op(MVI, 3, 0, 0),                   // 3 The result
+
+    // Multiplying loop
+    Op(ADDI, 2, 0, 1).label("loop"),    // 4 Add to the times multiplyed
+    Op(ADDR, 3, 0),                     // 5 Add the result
+    Op(CMP, 1, 2),                      // 6 Did we multiply R1 times
+    Op(JNZ, 0, 0, Target("loop")),      // 7 Jump to start of loop if not
+
+    // Stop program
+    Op(HLT, 0, 0)                       // 8
+});
+
+// storage.img built into the binary, with the copy loop or the DMA bootloader. ROM uses the words
+// where they are, so nothing is read from disk.
+constexpr std::array<uint32_t, STORAGE_SIZE_BYTES / 4> STORAGE_IMAGE = BootImage(LoopBootloader(), MULTIPLY_PROGRAM);
+constexpr std::array<uint32_t, STORAGE_SIZE_BYTES / 4> STORAGE_DMA_IMAGE = BootImage(DMABootloader(MULTIPLY_PROGRAM.size() * 4), MULTIPLY_PROGRAM);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <vector>
+
+#include "Instructions.h"
+
+const int TRACE_RING_RECORDS = 4096;            // Records buffered in memory before a flush
+const char TRACE_FILE_PATH[] = "trace.bin";
+
+// One executed instruction, written to the trace file as is (fixed size)
+struct TraceRecord
+{
+    uint32_t PC;                                // Adress of the executed instruction
+    uint32_t instruction;                       // Raw instruction word (operation + operands)
+    uint32_t registers[REGISTER_COUNT];         // Registers after the instruction
+    uint32_t ZF;                                // Zero flag after the instruction
+    uint32_t nextPC;                            // PC after the instruction, the handler or the instruction itself when it trapped
+};
+
+// Tracing policies, picked with CPU<Policy>. Every policy has the same three hooks, step() after
+// each executed instruction with the state and PC it left, access() after each load or store and
+// halt() when the program stops.
+
+// No tracing at all, the hooks are empty and get compiled out of the dispatch loop
+class NoTrace
+{
+public:
+    void step(uint32_t /*PC*/, uint32_t /*instruction*/, const uint32_t* /*registers*/, bool /*ZF*/, uint32_t /*nextPC*/) {}
+    void access(uint32_t /*adress*/, bool /*store*/, bool /*rom*/) {}
+    void halt(uint32_t /*PC*/, const uint32_t* /*registers*/, bool /*ZF*/) {}
+};
+
+// Counts the executed instructions and prints the final state at halt. Translated code (ENGINE_JIT)
+// doesn't reach the hooks, so only the instructions an interpreter ran are counted.
+class SummaryTrace
+{
+private:
+    uint64_t executed = 0;
+
+public:
+    void step(uint32_t /*PC*/, uint32_t /*instruction*/, const uint32_t* /*registers*/, bool /*ZF*/, uint32_t /*nextPC*/)
+    {
+        executed++;
+    }
+
+    void access(uint32_t /*adress*/, bool /*store*/, bool /*rom*/) {}
+
+    void halt(uint32_t PC, const uint32_t* registers, bool ZF)
+    {
+        std::cout << "Program halted after " << executed << " interpreted instructions\n";
+        std::cout << "PC: " << PC << '\n';
+        std::cout << "Registers:\n";
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            std::cout << "R" << i << " = " << int(registers[i]) << '\n';
+        std::cout << "ZF = " << ZF << '\n';
+    }
+};
+
+// Records every instruction in a ring of TraceRecords and writes it to the trace file
+// in batches when the ring fills up. Use TraceDecoder to turn the file back into text.
+class FullTrace
+{
+private:
+    std::vector<TraceRecord> ring;
+    size_t head = 0;                            // Next free record in the ring
+    std::ofstream file;
+
+    void flush()
+    {
+        file.write((const char*)(ring.data()), head * sizeof(TraceRecord));
+        file.flush();
+        head = 0;
+    }
+
+public:
+    FullTrace(const char* trace_file_path = TRACE_FILE_PATH)
+        : ring(TRACE_RING_RECORDS), file(trace_file_path, std::ios::binary)
+    {
+        if(!file) throw std::runtime_error("Failed to open trace file");
+    }
+
+    ~FullTrace()
+    {
+        flush();                                // Keep the records of a run that ended with an error
+    }
+
+    void step(uint32_t PC, uint32_t instruction, const uint32_t* registers, bool ZF, uint32_t nextPC)
+    {
+        TraceRecord& record = ring[head];
+        record.PC = PC;
+        record.instruction = instruction;
+        for(int i = 0; i < REGISTER_COUNT; ++i)
+            record.registers[i] = registers[i];
+        record.ZF = ZF;
+        record.nextPC = nextPC;
+
+        if(++head == ring.size())               // Ring is full, write the whole batch
+            flush();
+    }
+
+    void access(uint32_t /*adress*/, bool /*store*/, bool /*rom*/) {}
+
+    void halt(uint32_t /*PC*/, const uint32_t* /*registers*/, bool /*ZF*/)
+    {
+        flush();
+    }
+};
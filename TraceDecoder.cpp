@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+
+#include "Instructions.h"
+#include "Trace.h"
+
+void PrintInstruction(const TraceRecord& record)
+{
+    uint8_t operation = (record.instruction >> 24) & 0xFF;
+    uint8_t registerA = (record.instruction >> 20) & 0xF;
+    uint8_t registerB = (record.instruction >> 16) & 0xF;
+    uint16_t immediate = record.instruction & 0xFFFF;
+
+    const uint32_t* registers = record.registers;
+    uint32_t A = registerA < REGISTER_COUNT ? registers[registerA] : 0;
+    uint32_t B = registerB < REGISTER_COUNT ? registers[registerB] : 0;
+
+    switch (operation)
+    {
+    case MVR:       std::cout << "MVR -> R" << int(registerA) << "[" << A << "] = R" << int(registerB) << "[" << B << "]\n"; break;
+    case ADDR:      std::cout << "ADDR -> R" << int(registerA) << "[" << A << "] += R" << int(registerB) << "[" << B << "]\n"; break;
+    case SUBR:      std::cout << "SUBR -> R" << int(registerA) << "[" << A << "] -= R" << int(registerB) << "[" << B << "]\n"; break;
+    case MVI:       std::cout << "MVI -> R" << int(registerA) << "[" << A << "] = I[" << immediate << "]\n"; break;
+    case ADDI:      std::cout << "ADDI -> R" << int(registerA) << "[" << A << "] += I[" << immediate << "]\n"; break;
+    case SUBI:      std::cout << "SUBI -> R" << int(registerA) << "[" << A << "] -= I[" << immediate << "]\n"; break;
+    case CMP:       std::cout << "CMP -> R" << int(registerA) << "[" << A << "] ?= R" << int(registerB) << "[" << B << "]\n"; break;
+    case JMP:       std::cout << "JMP -> PC = I[" << immediate << "]\n"; break;
+    case JZ:        std::cout << "JZ -> PC = I[" << immediate << "]\n"; break;
+    case JNZ:       std::cout << "JNZ -> PC = I[" << immediate << "]\n"; break;
+    case HLT:       std::cout << "Program halted\n"; break;
+    case LOADR:     std::cout << "LOADR -> R" << int(registerA) << " = Memory(R" << int(registerB) << "[" << B << "])\n"; break;
+    case STORER:    std::cout << "STORER -> Memory(R" << int(registerB) << "[" << B << "]) = R" << int(registerA) << "[" << A << "]\n"; break;
+    case LOADI:     std::cout << "LOADI -> R" << int(registerA) << " = Memory(I[" << immediate << "])\n"; break;
+    case STOREI:    std::cout << "STOREI -> Memory(I[" << immediate << "]) = R" << int(registerA) << "[" << A << "]\n"; break;
+    case ANDR:      std::cout << "ANDR -> R" << int(registerA) << "[" << A << "] &= R" << int(registerB) << "[" << B << "]\n"; break;
+    case ANDI:      std::cout << "ANDI -> R" << int(registerA) << "[" << A << "] &= I[" << immediate << "]\n"; break;
+    case ORR:       std::cout << "ORR -> R" << int(registerA) << "[" << A << "] |= R" << int(registerB) << "[" << B << "]\n"; break;
+    case ORI:       std::cout << "ORI -> R" << int(registerA) << "[" << A << "] |= I[" << immediate << "]\n"; break;
+    case LSR:       std::cout << "LSR -> R" << int(registerA) << "[" << A << "] >>= I[" << immediate << "]\n"; break;
+    case LSL:       std::cout << "LSL -> R" << int(registerA) << "[" << A << "] <<= I[" << immediate << "]\n"; break;
+    case CAS:       std::cout << "CAS -> Memory(I[" << immediate << "]) ?= R" << int(registerA) << "[" << A << "] = R" << int(registerB) << "[" << B << "]\n"; break;
+    case FADD:      std::cout << "FADD -> R" << int(registerA) << " = Memory(R" << int(registerB) << "[" << B << "]) += R" << int(registerA) << "\n"; break;
+    case COREID:    std::cout << "COREID -> R" << int(registerA) << "[" << A << "]\n"; break;
+    case SETTRAP:   std::cout << "SETTRAP -> Handler = I[" << immediate << "]\n"; break;
+    case GETTRAP:   std::cout << "GETTRAP -> R" << int(registerA) << " = Cause, R" << int(registerB) << " = Trap PC\n"; break;
+    case NOP:       break;
+    default:        std::cout << "??? -> " << std::hex << record.instruction << std::dec << "\n"; break;
+    }
+}
+
+void PrintState(const TraceRecord& record)
+{
+    std::cout << "PC: " << record.nextPC << '\n';
+    std::cout << "Registers:\n";
+    for(int i = 0; i < REGISTER_COUNT; ++i)
+        std::cout << "R" << i << " = " << int(record.registers[i]) << '\n';
+    std::cout << '\n';
+}
+
+int main(int argc, char* argv[])
+{
+    const char* trace_file_path = argc > 1 ? argv[1] : TRACE_FILE_PATH;
+
+    std::ifstream trace(trace_file_path, std::ios::binary);
+    if(!trace)
+    {
+        std::cerr << "Failed to open trace file " << trace_file_path << '\n';
+        return 1;
+    }
+
+    TraceRecord record;
+    while(trace.read((char*)(&record), sizeof(TraceRecord)))
+    {
+        PrintInstruction(record);
+        PrintState(record);
+    }
+
+    return 0;
+}
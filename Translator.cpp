@@ -0,0 +1,417 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CPU.h"
+
+// Ahead of time translator: turns a storage.img into a C++ program that runs it natively.
+//
+// Every reachable instruction becomes a few lines of C++ in one function, with a label for
+// every goto target. Code the bootloader copies into RAM is found by running the image in
+// the interpreter until it first jumps into RAM and translating RAM from that moment. The
+// generated program checks that RAM still holds that code before it runs it and hands the
+// rest of the run to the interpreter when it doesn't. A load or store that faults hands the run
+// to the interpreter at its PC too, which then traps like CPU::run() would.
+
+const int TRACE_STEP_LIMIT = 100000000;             // Interpreter steps spent looking for the jump into RAM
+const char DEFAULT_OUTPUT_PATH[] = "storage_aot.cpp";
+
+struct Image
+{
+    std::vector<uint8_t> rom;
+    std::vector<uint8_t> ram;                       // RAM when the program first jumped into it
+    uint32_t romEnd;
+    uint32_t ramEnd;
+};
+
+bool Fetch(const Image& image, uint32_t adress, uint32_t& instruction)
+{
+    const std::vector<uint8_t>* bytes = &image.rom;
+    if(adress >= image.romEnd)
+    {
+        bytes = &image.ram;
+        adress -= image.romEnd;
+    }
+
+    if(adress + 3 >= bytes->size()) return false;
+
+    instruction = (*bytes)[adress]
+    | ((*bytes)[adress + 1] << 8)
+    | ((*bytes)[adress + 2] << 16)
+    | ((uint32_t)(*bytes)[adress + 3] << 24);
+    return true;
+}
+
+bool IsBranch(uint8_t operation)
+{
+    return operation == JMP || operation == JZ || operation == JNZ;
+}
+
+bool Translatable(uint32_t instruction)
+{
+    uint8_t operation = (instruction >> 24) & 0xFF;
+    uint8_t registerA = (instruction >> 20) & 0xF;
+    uint8_t registerB = (instruction >> 16) & 0xF;
+
+    return operation <= LSL && registerA < REGISTER_COUNT && registerB < REGISTER_COUNT;
+}
+
+// Walk the control flow graph from the entry points, collecting every reachable instruction
+// and the ones that start a basic block
+void Discover(const Image& image, std::vector<uint32_t> entries, std::set<uint32_t>& reachable, std::set<uint32_t>& leaders)
+{
+    for(uint32_t entry : entries)
+        leaders.insert(entry);
+
+    while(!entries.empty())
+    {
+        uint32_t PC = entries.back();
+        entries.pop_back();
+
+        while(reachable.insert(PC).second)
+        {
+            uint32_t instruction;
+            if(!Fetch(image, PC, instruction) || !Translatable(instruction)) break;
+
+            uint8_t operation = (instruction >> 24) & 0xFF;
+            uint16_t immediate = instruction & 0xFFFF;
+
+            if(IsBranch(operation))
+            {
+                leaders.insert(immediate);
+                entries.push_back(immediate);
+            }
+
+            if(operation == JMP || operation == HLT) break;
+            if(operation == JZ || operation == JNZ) leaders.insert(PC + 4);
+
+            PC += 4;
+        }
+    }
+}
+
+std::string Hex(uint32_t value)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%X", value);
+    return text;
+}
+
+std::string Label(uint32_t PC)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "L_%X", PC);
+    return text;
+}
+
+class Emitter
+{
+private:
+    const Image& image;
+    const std::set<uint32_t>& reachable;
+    std::ofstream& file;
+    std::ostringstream out;                         // Generated code, written to file at the end
+    std::set<uint32_t> targets;                     // Adresses translated code jumps to with goto
+
+    uint32_t codeStart;                             // RAM code range the generated program relies on
+    uint32_t codeEnd;
+
+    bool inRAMCode(uint32_t PC)
+    {
+        return PC >= codeStart && PC < codeEnd;
+    }
+
+    // Continue at a PC from translated code, checking RAM first when coming from outside it
+    void transfer(uint32_t from, uint32_t to, const char* indent)
+    {
+        if(!reachable.count(to))
+        {
+            out << indent << "return Interpret(memory, R, ZF, " << Hex(to) << ");\n";
+            return;
+        }
+
+        if(inRAMCode(to) && !inRAMCode(from))
+            out << indent << "if(!verified && !(verified = Verify(ram))) return Interpret(memory, R, ZF, " << Hex(to) << ");\n";
+
+        targets.insert(to);
+        out << indent << "goto " << Label(to) << ";\n";
+    }
+
+    void store(uint32_t PC, const std::string& adress, const char* value)
+    {
+        out << "    if(memory.store(" << adress << ", " << value << ")) return Interpret(memory, R, ZF, " << Hex(PC) << ");\n";
+
+        if(codeStart == codeEnd) return;
+
+        out << "    if(" << adress << " + 3 >= RAM_CODE_START && " << adress << " < RAM_CODE_END) verified = false;\n";
+        if(inRAMCode(PC))       // Running from RAM, the store may have changed the code that follows
+            out << "    if(!verified && !(verified = Verify(ram))) return Interpret(memory, R, ZF, " << Hex(PC + 4) << ");\n";
+    }
+
+    // A load that faults leaves the register alone, the interpreter runs it again and traps
+    void load(uint32_t PC, const std::string& adress, const std::string& value)
+    {
+        out << "    if(memory.load(" << adress << ", " << value << ")) return Interpret(memory, R, ZF, " << Hex(PC) << ");\n";
+    }
+
+    void instruction(uint32_t PC, uint32_t word)
+    {
+        uint8_t operation = (word >> 24) & 0xFF;
+        std::string A = "R[" + std::to_string((word >> 20) & 0xF) + "]";
+        std::string B = "R[" + std::to_string((word >> 16) & 0xF) + "]";
+        uint16_t immediate = word & 0xFFFF;
+        std::string I = Hex(immediate);
+
+        switch (operation)
+        {
+        case MVR:       out << "    " << A << " = " << B << ";\n"; break;
+        case ADDR:      out << "    " << A << " += " << B << ";\n"; break;
+        case SUBR:      out << "    " << A << " -= " << B << ";\n"; break;
+        case MVI:       out << "    " << A << " = " << I << ";\n"; break;
+        case ADDI:      out << "    " << A << " += " << I << ";\n"; break;
+        case SUBI:      out << "    " << A << " -= " << I << ";\n"; break;
+        case CMP:       out << "    ZF = (" << A << " == " << B << ");\n"; break;
+        case ANDR:      out << "    " << A << " &= " << B << ";\n"; break;
+        case ANDI:      out << "    " << A << " &= " << I << ";\n"; break;
+        case ORR:       out << "    " << A << " |= " << B << ";\n"; break;
+        case ORI:       out << "    " << A << " |= " << I << ";\n"; break;
+        case LSR:       out << "    " << A << " >>= " << (immediate & 31) << ";\n"; break;
+        case LSL:       out << "    " << A << " <<= " << (immediate & 31) << ";\n"; break;
+        case NOP:       break;
+        case LOADR:     load(PC, B, A); break;
+        case LOADI:
+        {
+            uint32_t value;
+            if(uint32_t(immediate) + 3 < image.romEnd && Fetch(image, immediate, value))
+                out << "    " << A << " = " << Hex(value) << ";\n";     // ROM never changes
+            else
+                load(PC, I, A);
+            break;
+        }
+        case STORER:    store(PC, B, A.c_str()); break;
+        case STOREI:    store(PC, I, A.c_str()); break;
+        case JMP:
+            transfer(PC, immediate, "    ");
+            break;
+        case JZ:
+        case JNZ:
+            out << "    if(" << (operation == JZ ? "ZF" : "!ZF") << ")\n    {\n";
+            transfer(PC, immediate, "        ");
+            out << "    }\n";
+            break;
+        case HLT:
+            out << "    return Halt(R, ZF, " << Hex(PC) << ");\n";
+            break;
+        }
+    }
+
+    // The Run() function, every reachable instruction in order
+    void translate()
+    {
+        // Without RAM code nothing checks RAM
+        out << "static CPUState Run(MEMC& memory" << (codeStart != codeEnd ? ", RAM& ram" : ", RAM&") << ")\n{\n";
+        out << "    uint32_t R[REGISTER_COUNT] = {};\n";
+        out << "    bool ZF = false;\n";
+        if(codeStart != codeEnd)
+            out << "    bool verified = false;             // RAM holds the translated RAM code\n";
+        out << "\n";
+
+        uint32_t previous = 0;
+        bool fallsThrough = false;
+        for(uint32_t PC : reachable)
+        {
+            if(fallsThrough && PC != previous + 4)
+                transfer(previous, previous + 4, "    ");
+
+            uint32_t word;
+            bool valid = Fetch(image, PC, word) && Translatable(word);
+
+            if(fallsThrough && PC == previous + 4 && PC == image.romEnd)
+                transfer(previous, PC, "    ");  // Falling from ROM into RAM
+
+            if(targets.count(PC))
+                out << Label(PC) << ":\n";
+
+            if(!valid)
+            {
+                out << "    return Interpret(memory, R, ZF, " << Hex(PC) << ");\n";
+                fallsThrough = false;
+                continue;
+            }
+
+            instruction(PC, word);
+
+            uint8_t operation = (word >> 24) & 0xFF;
+            fallsThrough = operation != JMP && operation != HLT;
+            previous = PC;
+        }
+
+        if(fallsThrough)
+            transfer(previous, previous + 4, "    ");
+
+        out << "}\n\n";
+    }
+
+public:
+    Emitter(const Image& image, const std::set<uint32_t>& reachable, std::ofstream& file)
+        : image(image), reachable(reachable), file(file)
+    {
+        codeStart = codeEnd = image.romEnd;
+        for(uint32_t PC : reachable)
+            if(PC >= image.romEnd)
+            {
+                if(codeStart == codeEnd) codeStart = PC;
+                codeEnd = PC + 4;
+            }
+    }
+
+    void emit(const char* image_path)
+    {
+        out << "// Generated by Translator from " << image_path << ", do not edit\n\n";
+        out << "#include <iostream>\n\n#include \"CPU.h\"\n\n";
+
+        out << "static const uint8_t IMAGE[" << image.rom.size() << "] =\n{";
+        for(size_t i = 0; i < image.rom.size(); i++)
+            out << (i % 16 ? " " : "\n    ") << Hex(image.rom[i]) << ",";
+        out << "\n};\n\n";
+
+        if(codeStart != codeEnd)
+        {
+            out << "static const uint32_t RAM_CODE_START = " << Hex(codeStart) << ";\n";
+            out << "static const uint32_t RAM_CODE_END = " << Hex(codeEnd) << ";\n";
+            out << "static const uint8_t RAM_CODE[] =\n{";
+            for(uint32_t adress = codeStart; adress < codeEnd; adress++)
+                out << ((adress - codeStart) % 16 ? " " : "\n    ") << Hex(image.ram[adress - image.romEnd]) << ",";
+            out << "\n};\n\n";
+
+            out <<
+                "// The RAM code was translated from what the bootloader copied there\n"
+                "static bool Verify(RAM& ram)\n"
+                "{\n"
+                "    for(uint32_t adress = RAM_CODE_START; adress < RAM_CODE_END; adress++)\n"
+                "        if(ram.bytes()[adress - " << Hex(image.romEnd) << "] != RAM_CODE[adress - RAM_CODE_START]) return false;\n"
+                "    return true;\n"
+                "}\n\n";
+        }
+
+        out <<
+            "static void PrintState(const CPUState& state)\n"
+            "{\n"
+            "    std::cout << \"Program halted\\n\";\n"
+            "    std::cout << \"PC: \" << state.PC << '\\n';\n"
+            "    std::cout << \"Registers:\\n\";\n"
+            "    for(int i = 0; i < REGISTER_COUNT; ++i)\n"
+            "        std::cout << \"R\" << i << \" = \" << int(state.registers[i]) << '\\n';\n"
+            "    std::cout << \"ZF = \" << state.ZF << '\\n';\n"
+            "    if(state.TRAPPED)\n"
+            "        std::cout << \"Trap: \" << FaultName(state.trapCause) << \" at PC \" << state.trapPC << '\\n';\n"
+            "}\n\n"
+            "static CPUState Halt(const uint32_t* R, bool ZF, uint32_t PC)\n"
+            "{\n"
+            "    CPUState state = {};\n"
+            "    for(int i = 0; i < REGISTER_COUNT; ++i)\n"
+            "        state.registers[i] = R[i];\n"
+            "    state.PC = PC;\n"
+            "    state.HALTED = true;\n"
+            "    state.ZF = ZF;\n"
+            "    return state;\n"
+            "}\n\n"
+            "// Finish the run in the interpreter from PC\n"
+            "static CPUState Interpret(MEMC& memory, const uint32_t* R, bool ZF, uint32_t PC)\n"
+            "{\n"
+            "    CPU<NoTrace> cpu(&memory);\n"
+            "    CPUState state = Halt(R, ZF, PC);\n"
+            "    state.HALTED = false;\n"
+            "    cpu.setState(state);\n"
+            "    cpu.run();\n"
+            "    return cpu.getState();\n"
+            "}\n\n";
+
+        // A first translation finds the goto targets, only they get a label in the second
+        std::string header = out.str();
+        translate();
+        out.str("");
+        out << header;
+        translate();
+
+        out <<
+            "int main()\n"
+            "{\n"
+            "    try\n"
+            "    {\n"
+            "        ROM rom(IMAGE, sizeof(IMAGE));\n"
+            "        RAM ram(" << image.ram.size() << ");\n"
+            "        MEMC memory(&rom, &ram);\n\n"
+            "        PrintState(Run(memory, ram));\n"
+            "    }\n"
+            "    catch(const std::runtime_error& e)\n"
+            "    {\n"
+            "        std::cerr << \"Runtime error: \" << e.what() << '\\n';\n"
+            "    }\n"
+            "    catch(const std::out_of_range& e)\n"
+            "    {\n"
+            "        std::cerr << \"Out of range: \" << e.what() << '\\n';\n"
+            "    }\n\n"
+            "    return 0;\n"
+            "}\n";
+
+        file << out.str();
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    const char* image_path = argc > 1 ? argv[1] : ROM_FILE_PATH;
+    const char* output_path = argc > 2 ? argv[2] : DEFAULT_OUTPUT_PATH;
+
+    try
+    {
+        ROM rom(image_path);
+        RAM ram(MEMORY_SIZE_BYTES);
+        MEMC memory(&rom, &ram);
+
+        // Trace the bootloader until it jumps into RAM, RAM code is translated from that moment
+        std::vector<uint32_t> entries = { 0x0 };
+        {
+            CPU<NoTrace> cpu(&memory);
+            for(int i = 0; i < TRACE_STEP_LIMIT && !cpu.getState().HALTED; i++)
+            {
+                cpu.step();
+                if(cpu.getState().PC >= memory.ROM_PARTITION_END)
+                {
+                    entries.push_back(cpu.getState().PC);
+                    break;
+                }
+            }
+        }
+
+        Image image;
+        image.rom = std::vector<uint8_t>(rom.bytes(), rom.bytes() + rom.size());
+        image.ram = std::vector<uint8_t>(ram.bytes(), ram.bytes() + ram.size());
+        image.romEnd = memory.ROM_PARTITION_END;
+        image.ramEnd = memory.RAM_PARTITION_END;
+
+        std::set<uint32_t> reachable;
+        std::set<uint32_t> leaders;
+        Discover(image, entries, reachable, leaders);
+
+        std::ofstream out(output_path);
+        if(!out) throw std::runtime_error("Failed to open output file");
+
+        Emitter(image, reachable, out).emit(image_path);
+
+        std::cout << "Translated " << reachable.size() << " instructions (" << leaders.size() << " blocks) into " << output_path << '\n';
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,20 +1,50 @@
 #include <iostream>
+#include <cstring>
+#include <memory>
 
-#include "CPU.h"
+#include "Snapshot.h"
+#include "Profile.h"
+#include "Storage.h"
 
-const int MEMORY_SIZE_BYTES = 1024; // 1 KB
+template<typename TracePolicy>
+void start(Engine engine, RAMLayout layout, bool embedded)
+{
+    std::unique_ptr<ROM> rom(embedded ? new ROM(STORAGE_IMAGE) : new ROM(ROM_FILE_PATH));  // Initialize ROM object
+    Machine<TracePolicy> machine(rom.get(), MEMORY_SIZE_BYTES, engine, layout);  // RAM, MEMORY CONTROLER and CPU over it
+
+    machine.getCPU().run();                                             // Start CPU 
+
+    CPUState state = machine.getCPU().getState();
+    if(state.TRAPPED)                                                   // Halted by a trap the guest didn't handle
+        std::cerr << "Trap: " << FaultName(state.trapCause) << " at PC " << state.trapPC << '\n';
+}
 
-int main()
+int main(int argc, char* argv[])
 {
-    try 
-    {
-        ROM* rom = new ROM(ROM_FILE_PATH);              // Initialize ROM object
-        RAM* ram = new RAM(MEMORY_SIZE_BYTES);          // Initialize RAM object
-        MEMC* memory_controler = new MEMC(rom, ram);    // Initialize MEMORY CONTROLER object
+    bool full_trace = false;
+    bool profile = false;
+    Engine engine = ENGINE_HANDLER;
+    RAMLayout layout = RAM_DENSE;
+    bool embedded = false;
 
-        CPU cpu(memory_controler);                      // Initialize CPU object
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--trace") == 0) full_trace = true;             // Record every instruction in trace.bin (read it with TraceDecoder)
+        if(std::strcmp(argv[i], "--profile") == 0) profile = true;              // Write profile.txt and profile.folded at halt
+        if(std::strcmp(argv[i], "--threaded") == 0) engine = ENGINE_THREADED;   // Use the threaded interpreter core
+        if(std::strcmp(argv[i], "--jit") == 0) engine = ENGINE_JIT;             // Translate the program to host code
+        if(std::strcmp(argv[i], "--sparse") == 0) layout = RAM_SPARSE;          // Allocate RAM pages when they are first written
+        if(std::strcmp(argv[i], "--embedded") == 0) embedded = true;            // Run the image built into the binary, not storage.img
+    }
 
-        cpu.run();                                      // Start CPU 
+    try 
+    {
+        if(full_trace)
+            start<FullTrace>(engine, layout, embedded);
+        else if(profile)
+            start<ProfileTrace>(engine, layout, embedded);
+        else
+            start<SummaryTrace>(engine, layout, embedded);                // Just print the final state
     }
     catch(const std::runtime_error& e)
     {
@@ -26,4 +56,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}